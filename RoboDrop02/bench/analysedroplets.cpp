@@ -0,0 +1,114 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// Ueva::analyseDroplets on a fixed set of droplet contours with 1 to all opencv worker threads
+// console program, build release x64 with prop_opencv_release.props and prop_qt_console.props, compiling
+// this file with ../ueva/uevafunctions.cpp uevastructures.cpp uevabitimage.cpp uevactrldesign.cpp,
+// linking Qt5Core and Qt5Gui, optional argument is number of droplets
+// analyseDroplets stays serial below STRIPE_MIN_POINTS contour points per stripe, run with 5, 20, 50 and 200
+// droplets to check that threshold: below it every thread count must time the same as 1 thread
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "opencv2/core.hpp"
+#include "opencv2/core/utility.hpp"
+#include "opencv2/imgproc.hpp"
+#include <QElapsedTimer>
+
+#include "../ueva/uevafunctions.h"
+
+static double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+int main(int argc, char *argv[])
+{
+	const int WIDTH = 2560;
+	const int HEIGHT = 2160;
+	const int REPEAT = 50;
+	const int numDroplets = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200;
+
+	// pinching droplets, two overlapping ellipses of random size and angle each, so every one has kink and neck
+	cv::RNG rng(7);
+	cv::Mat image(HEIGHT, WIDTH, CV_8UC1, cv::Scalar_<int>(0));
+	const int cell = 100;
+	const int columns = WIDTH / cell;
+	for (int i = 0; i < numDroplets && i < columns * (HEIGHT / cell); i++)
+	{
+		cv::Point_<int> center((i % columns) * cell + cell / 2, (i / columns) * cell + cell / 2);
+		double angle = rng.uniform(0.0, 180.0);
+		cv::Size_<int> axes(rng.uniform(14, 24), rng.uniform(8, 14));
+		cv::Point_<int> shift(rng.uniform(-12, 12), rng.uniform(-12, 12));
+		cv::ellipse(image, center - shift, axes, angle, 0, 360, cv::Scalar_<int>(255), -1);
+		cv::ellipse(image, center + shift, axes, angle + rng.uniform(-30.0, 30.0), 0, 360, cv::Scalar_<int>(255), -1);
+	}
+	std::vector<std::vector< cv::Point_<int> >> contours;
+	cv::findContours(image, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+
+	// dashboard defaults
+	UevaSettings settings;
+	settings.imgprocConvexSize = 7;
+	settings.imgprocPersistence = 7;
+
+	int numPoints = 0;
+	for (int i = 0; i < contours.size(); i++)
+	{
+		numPoints += (int)contours[i].size();
+	}
+	std::printf("%d contours, %d points, median of %d, %d cpus\n", (int)contours.size(), numPoints, REPEAT,
+		cv::getNumberOfCPUs());
+	std::vector<UevaDroplet> reference;
+	std::vector<UevaDroplet> droplets;
+	std::vector<UevaShapeScratch> scratches;
+	double serial = 0.0;
+	bool same = true;
+	for (int threads = 1; threads <= cv::getNumberOfCPUs(); threads++)
+	{
+		cv::setNumThreads(threads);
+		std::vector<double> ms;
+		QElapsedTimer timer;
+		for (int i = 0; i < REPEAT; i++)
+		{
+			timer.start();
+			Ueva::analyseDroplets(contours, settings, droplets, scratches);
+			ms.push_back(timer.nsecsElapsed() / 1e6);
+		}
+		double time = median(ms);
+		if (threads == 1)
+		{
+			serial = time;
+			reference = droplets;
+		}
+		for (int j = 0; j < droplets.size(); j++)
+		{
+			same = same &&
+				droplets[j].kinkIndex == reference[j].kinkIndex &&
+				droplets[j].neckIndex == reference[j].neckIndex &&
+				droplets[j].neckDistance == reference[j].neckDistance;
+		}
+		std::printf("%2d threads: %.3f ms, speed up %.2f\n", threads, time, serial / time);
+	}
+	std::printf(same ? "droplets identical\n" : "DROPLETS DIFFER\n");
+	return same ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// Ueva::detectKink and Ueva::detectNeck against the old full contour hull and p1d::Persistence1D path
+// console program, build release x64 with prop_opencv_release.props and prop_qt_console.props, compiling
+// this file with ../ueva/uevafunctions.cpp uevastructures.cpp uevabitimage.cpp uevactrldesign.cpp,
+// linking Qt5Core and Qt5Gui, optional argument is number of droplets
+// contour start is rotated to a random point so kinks also land near contour index 0
+// returns 1 if a kink is found where old path found none
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "opencv2/core.hpp"
+#include "opencv2/core/utility.hpp"
+#include "opencv2/imgproc.hpp"
+#include <QElapsedTimer>
+
+#include "../ueva/uevafunctions.h"
+
+//// OLD PATH, as it was before simplified hull and stack persistence
+
+static int oldDetectKink(std::vector< cv::Point_<int>> &contour, const int convexSize)
+{
+	std::vector<int> hull;
+	cv::convexHull(contour, hull);
+
+	std::vector<cv::Vec4i> defects;
+	cv::convexityDefects(contour, hull, defects);
+
+	int kinkIndex = -1;
+	int depth = 0;
+	for (int i = 0; i < defects.size(); i++)
+	{
+		if (defects[i][2] > defects[i][0] && defects[i][2] < defects[i][1]) // filter opencv bug
+		{
+			if (defects[i][3] > convexSize * 256) // filter small defects
+			{
+				if (defects[i][3] > depth) // get deepest defect
+				{
+					depth = defects[i][3];
+					kinkIndex = defects[i][2];
+				}
+			}
+		}
+	}
+	return kinkIndex;
+}
+
+static int oldDetectNeck(std::vector< cv::Point_<int>> &contour, int &kinkIndex, float &neckDistance, const int threshold)
+{
+	int n = (int)contour.size();
+	std::vector<float> profile;
+	for (int k = 0; k < n; k++)
+	{
+		int i = (kinkIndex + k) % n;
+		float dx = float(contour[i].x - contour[kinkIndex].x);
+		float dy = float(contour[i].y - contour[kinkIndex].y);
+		profile.push_back(std::sqrt(dx * dx + dy * dy));
+	}
+
+	p1d::Persistence1D persistence;
+	persistence.RunPersistence(profile);
+	std::vector< p1d::TPairedExtrema > extremas;
+	persistence.GetPairedExtrema(extremas, float(threshold));
+
+	int neckIndex = -1;
+	neckDistance = 0.0;
+	if (extremas.size() == 2) // 2 maxima droplet is healthy, 1st minima is neck
+	{
+		int first = extremas[0].MinIndex < extremas[1].MinIndex ? 0 : 1;
+		neckIndex = (kinkIndex + extremas[first].MinIndex) % n;
+		neckDistance = profile[extremas[first].MinIndex];
+	}
+	else if (extremas.size() >= 3)  // 3 or more maxima droplet is overgrown, 2nd maxima is neck
+	{
+		std::sort(extremas.begin(), extremas.end(),
+			[](const p1d::TPairedExtrema &a, const p1d::TPairedExtrema &b)
+		{
+			return a.MaxIndex < b.MaxIndex;
+		});
+		neckIndex = (kinkIndex + extremas[1].MaxIndex) % n;
+		neckDistance = profile[extremas[1].MaxIndex];
+	}
+	return neckIndex;
+}
+
+//// BENCH
+
+int main(int argc, char *argv[])
+{
+	const int WIDTH = 2560;
+	const int HEIGHT = 2160;
+	const int numDroplets = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+	const int convexSize = 7; // dashboard defaults
+	const int persistence = 7;
+
+	// pinching droplets of growing size, two overlapping ellipses each, drawn a batch per image
+	cv::RNG rng(11);
+	std::vector<std::vector< cv::Point_<int> >> contours;
+	while (contours.size() < numDroplets)
+	{
+		cv::Mat image(HEIGHT, WIDTH, CV_8UC1, cv::Scalar_<int>(0));
+		int scale = 1 + (int)contours.size() * 8 / numDroplets; // long axis 14 to 190 px
+		int cell = 100 * scale;
+		int columns = WIDTH / cell;
+		for (int i = 0; i < columns * (HEIGHT / cell); i++)
+		{
+			cv::Point_<int> center((i % columns) * cell + cell / 2, (i / columns) * cell + cell / 2);
+			double angle = rng.uniform(0.0, 180.0);
+			cv::Size_<int> axes(rng.uniform(14, 24) * scale, rng.uniform(8, 14) * scale);
+			cv::Point_<int> shift(rng.uniform(-12, 12) * scale, rng.uniform(-12, 12) * scale);
+			cv::ellipse(image, center - shift, axes, angle, 0, 360, cv::Scalar_<int>(255), -1);
+			cv::ellipse(image, center + shift, axes, angle + rng.uniform(-30.0, 30.0), 0, 360, cv::Scalar_<int>(255), -1);
+		}
+		std::vector<std::vector< cv::Point_<int> >> batch;
+		cv::findContours(image, batch, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+		for (int i = 0; i < batch.size() && contours.size() < numDroplets; i++)
+		{
+			std::rotate(batch[i].begin(), batch[i].begin() + rng.uniform(0, (int)batch[i].size()), batch[i].end());
+			contours.push_back(batch[i]);
+		}
+	}
+
+	UevaShapeScratch scratch;
+	int sameKink = 0;
+	int extraKink = 0;
+	int missedKink = 0;
+	int otherKink = 0;
+	int sameNeck = 0;
+	int otherNeck = 0;
+	long long points = 0;
+	double oldMs = 0.0;
+	double newMs = 0.0;
+	QElapsedTimer timer;
+	for (int i = 0; i < contours.size(); i++)
+	{
+		std::vector< cv::Point_<int>> &contour = contours[i];
+		points += contour.size();
+
+		timer.start();
+		int oldKink = oldDetectKink(contour, convexSize);
+		int oldNeck = -1;
+		float oldDistance = 0;
+		if (oldKink != -1)
+		{
+			oldNeck = oldDetectNeck(contour, oldKink, oldDistance, persistence);
+		}
+		oldMs += timer.nsecsElapsed() / 1e6;
+
+		timer.start();
+		int newKink = Ueva::detectKink(contour, convexSize, scratch);
+		int newNeck = -1;
+		float newDistance = 0;
+		if (newKink != -1)
+		{
+			newNeck = Ueva::detectNeck(contour, newKink, newDistance, persistence, scratch);
+		}
+		newMs += timer.nsecsElapsed() / 1e6;
+
+		if (newKink == oldKink)
+		{
+			sameKink++;
+			if (newNeck == oldNeck && newDistance == oldDistance)
+			{
+				sameNeck++;
+			}
+			else
+			{
+				otherNeck++;
+				std::printf("droplet %d, %d points: neck %d %.2f, old %d %.2f\n",
+					i, (int)contour.size(), newNeck, newDistance, oldNeck, oldDistance);
+			}
+		}
+		else if (oldKink == -1)
+		{
+			extraKink++;
+			std::printf("droplet %d, %d points: kink %d, old none\n", i, (int)contour.size(), newKink);
+		}
+		else if (newKink == -1)
+		{
+			missedKink++;
+			std::printf("droplet %d, %d points: no kink, old %d\n", i, (int)contour.size(), oldKink);
+		}
+		else
+		{
+			otherKink++;
+			std::printf("droplet %d, %d points: kink %d, old %d\n", i, (int)contour.size(), newKink, oldKink);
+		}
+	}
+
+	std::printf("%d droplets, %.0f points on average\n", (int)contours.size(), double(points) / contours.size());
+	std::printf("kink same %d, extra %d, missed %d, elsewhere %d\n", sameKink, extraKink, missedKink, otherKink);
+	std::printf("neck same %d, differ %d, of same kinks\n", sameNeck, otherNeck);
+	std::printf("old %.3f ms, new %.3f ms, speed up %.2f\n", oldMs, newMs, oldMs / newMs);
+	return extraKink == 0 ? 0 : 1;
+}
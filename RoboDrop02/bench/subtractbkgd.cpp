@@ -0,0 +1,101 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// fused Ueva::subtractBkgd against the absdiff, threshold and bitwise_and it replaced, at zyla full frame
+// console program, build release x64 with prop_opencv_release.props and prop_qt_console.props, compiling
+// this file with ../ueva/uevafunctions.cpp uevastructures.cpp uevabitimage.cpp uevactrldesign.cpp,
+// linking Qt5Core and Qt5Gui
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include <QElapsedTimer>
+
+#include "../ueva/uevafunctions.h"
+
+static double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	return v[v.size() / 2];
+}
+
+// median ms of both versions, false when outputs differ
+static bool compare(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const int threshold,
+	const int repeat, double &threePass, double &fused)
+{
+	cv::Mat diff, refEdges, refMarkers, edges, markers;
+	std::vector<double> threePassMs, fusedMs;
+	QElapsedTimer timer;
+	for (int i = 0; i < repeat; i++)
+	{
+		timer.start();
+		cv::absdiff(rawGray, bkgd, diff);
+		cv::threshold(diff, refEdges, threshold, 255, cv::THRESH_BINARY);
+		cv::bitwise_and(refEdges, markerMask, refMarkers);
+		threePassMs.push_back(timer.nsecsElapsed() / 1e6);
+
+		timer.start();
+		Ueva::subtractBkgd(rawGray, bkgd, markerMask, threshold, edges, markers);
+		fusedMs.push_back(timer.nsecsElapsed() / 1e6);
+	}
+	threePass = median(threePassMs);
+	fused = median(fusedMs);
+	return cv::countNonZero(edges != refEdges) == 0 && cv::countNonZero(markers != refMarkers) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const int WIDTH = 2560;
+	const int HEIGHT = 2160;
+	const int THRESHOLD = 25; // dashboard default
+	const int REPEAT = 200;
+
+	// noisy background, darker droplets, marker mask over every other channel
+	cv::RNG rng(1);
+	cv::Mat bkgd(HEIGHT, WIDTH, CV_8UC1);
+	rng.fill(bkgd, cv::RNG::UNIFORM, 100, 200);
+	cv::Mat noise(HEIGHT, WIDTH, CV_8UC1);
+	rng.fill(noise, cv::RNG::UNIFORM, 0, 20);
+	cv::Mat rawGray = bkgd + noise;
+	cv::Mat markerMask(HEIGHT, WIDTH, CV_8UC1, cv::Scalar_<int>(0));
+	for (int y = 64; y + 64 < HEIGHT; y += 256)
+	{
+		cv::rectangle(markerMask, cv::Rect_<int>(0, y, WIDTH, 64), cv::Scalar_<int>(255), -1);
+		for (int x = 100; x + 100 < WIDTH; x += 400)
+		{
+			cv::circle(rawGray, cv::Point_<int>(x, y + 32), 30, cv::Scalar_<int>(40), -1);
+		}
+	}
+
+	std::printf("%d x %d, median of %d, threshold %d\n", WIDTH, HEIGHT, REPEAT, THRESHOLD);
+	bool same = true;
+	for (int optimized = 1; optimized >= 0; optimized--)
+	{
+		cv::setUseOptimized(optimized != 0);
+		double threePass, fused;
+		same = compare(rawGray, bkgd, markerMask, THRESHOLD, REPEAT, threePass, fused) && same;
+		std::printf("%s: absdiff threshold bitwise_and %.2f ms, subtractBkgd %.2f ms\n",
+			optimized ? "optimized" : "scalar", threePass, fused);
+	}
+	std::printf(same ? "outputs identical\n" : "OUTPUTS DIFFER\n");
+	return same ? 0 : 1;
+}
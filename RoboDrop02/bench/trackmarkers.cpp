@@ -0,0 +1,225 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+// Ueva::trackMarkerIdentities against the distance matrix version it replaced, identities of random cases then timing
+// console program, build release x64 with prop_opencv_release.props and prop_qt_console.props, compiling
+// this file with ../ueva/uevafunctions.cpp uevastructures.cpp uevabitimage.cpp uevactrldesign.cpp,
+// linking Qt5Core and Qt5Gui
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "opencv2/core.hpp"
+#include <QElapsedTimer>
+
+#include "../ueva/uevafunctions.h"
+
+// tracking before the grid, full distance matrix and its transpose, kept verbatim as reference
+static void matrixTrackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vector<UevaMarker> &oldMarkers, int trackTooFar)
+{
+	// distance matrix (each row corresponds to a newMarker)
+	std::vector<std::vector<float>> l2NormMatrix;
+	for (int i = 0; i < newMarkers.size(); i++)
+	{
+		std::vector<float> l2NormVector;
+		for (int j = 0; j < oldMarkers.size(); j++)
+		{
+			float l2Norm = sqrt(
+				pow(float(newMarkers[i].centroid.x - oldMarkers[j].centroid.x), 2) +
+				pow(float(newMarkers[i].centroid.y - oldMarkers[j].centroid.y), 2)
+				);
+			l2NormVector.push_back(l2Norm);
+		}
+		l2NormMatrix.push_back(l2NormVector);
+	}
+	// distance matrix transpose (each row corresponds to an oldMarker)
+	std::vector<std::vector<float>> l2NormMatrixT;
+	for (int j = 0; j < oldMarkers.size(); j++)
+	{
+		std::vector<float> l2NormVectorT;
+		for (int i = 0; i < newMarkers.size(); i++)
+		{
+			float l2NormT = l2NormMatrix[i][j];
+			l2NormVectorT.push_back(l2NormT);
+		}
+		l2NormMatrixT.push_back(l2NormVectorT);
+	}
+	// newMarker assiociates itself with oldMarker
+	std::vector<int> newOldIndices;
+	if (l2NormMatrixT.size() > 0)
+	{
+		for (int i = 0; i < l2NormMatrix.size(); i++)
+		{
+			std::vector<float>::iterator iter = std::min_element(l2NormMatrix[i].begin(), l2NormMatrix[i].end());
+			if (*iter <= trackTooFar)
+			{
+				newOldIndices.push_back(iter - l2NormMatrix[i].begin());
+			}
+			else
+			{
+				newOldIndices.push_back(-1);
+			}
+		}
+	}
+	// oldMarker associates itself with newMarker
+	std::vector<int> oldNewIndices;
+	if (l2NormMatrix.size() > 0)
+	{
+		for (int j = 0; j < l2NormMatrixT.size(); j++)
+		{
+			std::vector<float>::iterator iter = std::min_element(l2NormMatrixT[j].begin(), l2NormMatrixT[j].end());
+			if (*iter <= trackTooFar)
+			{
+				oldNewIndices.push_back(iter - l2NormMatrixT[j].begin());
+			}
+			else
+			{
+				oldNewIndices.push_back(-1);
+			}
+		}
+	}
+	// round trip consensus
+	for (int i = 0; i < newOldIndices.size(); i++)
+	{
+		int j = newOldIndices[i];
+		if (j > -1)
+		{
+			int iReturn = oldNewIndices[j];
+			if (i == iReturn)
+			{
+				newMarkers[i].identity = oldMarkers[j].identity;
+			}
+		}
+	}
+	// give identity to newly appeared markers
+	for (int i = 0; i < newMarkers.size(); i++)
+	{
+		if (newMarkers[i].identity == -1)
+		{
+			UevaMarker::counter++;
+			newMarkers[i].identity = UevaMarker::counter;
+		}
+	}
+}
+
+// optimal step may only add matches, each unique and in range
+static bool checkOptimal(const std::vector<UevaMarker> &greedy, const std::vector<UevaMarker> &optimal,
+	const std::vector<UevaMarker> &oldMarkers, const int firstOld, const int trackTooFar)
+{
+	std::vector<int> seen;
+	int greedyMatches = 0;
+	for (int i = 0; i < optimal.size(); i++)
+	{
+		greedyMatches += greedy[i].identity >= firstOld;
+		if (optimal[i].identity >= firstOld)
+		{
+			const cv::Point_<int> &old = oldMarkers[optimal[i].identity - firstOld].centroid;
+			long long dx = old.x - optimal[i].centroid.x;
+			long long dy = old.y - optimal[i].centroid.y;
+			if (dx * dx + dy * dy > (long long)trackTooFar * trackTooFar)
+			{
+				return false;
+			}
+			seen.push_back(optimal[i].identity);
+		}
+	}
+	std::sort(seen.begin(), seen.end());
+	return std::adjacent_find(seen.begin(), seen.end()) == seen.end() && (int)seen.size() >= greedyMatches;
+}
+
+int main(int argc, char *argv[])
+{
+	const int NUM_CASES = 3000;
+	const int FIRST_OLD = 1000; // old identities, above anything counter hands out in a case
+
+	// small crowded cases, greedy identities must equal matrix version exactly
+	std::srand(3);
+	for (int c = 0; c < NUM_CASES; c++)
+	{
+		int numNew = std::rand() % 30;
+		int numOld = std::rand() % 30;
+		int range = 1 + std::rand() % 300;
+		int trackTooFar = std::rand() % 60;
+		std::vector<UevaMarker> oldMarkers(numOld);
+		std::vector<UevaMarker> matrix(numNew);
+		for (int j = 0; j < numOld; j++)
+		{
+			oldMarkers[j].identity = FIRST_OLD + j;
+			oldMarkers[j].centroid = cv::Point_<int>(std::rand() % range, std::rand() % range);
+		}
+		for (int i = 0; i < numNew; i++)
+		{
+			matrix[i].centroid = cv::Point_<int>(std::rand() % range, std::rand() % range);
+		}
+		std::vector<UevaMarker> grid = matrix;
+		std::vector<UevaMarker> optimal = matrix;
+
+		UevaMarker::counter = 0;
+		matrixTrackMarkerIdentities(matrix, oldMarkers, trackTooFar);
+		UevaMarker::counter = 0;
+		Ueva::trackMarkerIdentities(grid, oldMarkers, trackTooFar, false);
+		UevaMarker::counter = 0;
+		Ueva::trackMarkerIdentities(optimal, oldMarkers, trackTooFar, true);
+		for (int i = 0; i < numNew; i++)
+		{
+			if (grid[i].identity != matrix[i].identity)
+			{
+				std::printf("case %d: grid identity differs from matrix version\n", c);
+				return 1;
+			}
+		}
+		if (!checkOptimal(grid, optimal, oldMarkers, FIRST_OLD, trackTooFar))
+		{
+			std::printf("case %d: optimal tracking lost, repeated or stretched a match\n", c);
+			return 1;
+		}
+	}
+	std::printf("%d cases, grid identities equal matrix version, optimal only adds matches\n", NUM_CASES);
+
+	// full frame of markers, each moved a few pixels
+	const int sizes[] = { 100, 1000, 5000 };
+	for (int s = 0; s < 3; s++)
+	{
+		int n = sizes[s];
+		std::vector<UevaMarker> oldMarkers(n);
+		std::vector<UevaMarker> matrix(n);
+		for (int j = 0; j < n; j++)
+		{
+			oldMarkers[j].identity = j;
+			oldMarkers[j].centroid = cv::Point_<int>(std::rand() % 2560, std::rand() % 2160);
+			matrix[j].centroid = oldMarkers[j].centroid + cv::Point_<int>(std::rand() % 7 - 3, std::rand() % 7 - 3);
+		}
+		std::vector<UevaMarker> grid = matrix;
+		std::vector<UevaMarker> optimal = matrix;
+		QElapsedTimer timer;
+		timer.start();
+		matrixTrackMarkerIdentities(matrix, oldMarkers, 20);
+		double matrixMs = timer.nsecsElapsed() / 1e6;
+		timer.start();
+		Ueva::trackMarkerIdentities(grid, oldMarkers, 20, false);
+		double gridMs = timer.nsecsElapsed() / 1e6;
+		timer.start();
+		Ueva::trackMarkerIdentities(optimal, oldMarkers, 20, true);
+		double optimalMs = timer.nsecsElapsed() / 1e6;
+		std::printf("%5d markers: matrix %.2f ms, grid %.3f ms, grid and optimal %.3f ms\n", n, matrixMs, gridMs, optimalMs);
+	}
+	return 0;
+}
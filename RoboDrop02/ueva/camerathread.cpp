@@ -18,116 +18,218 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "camerathread.h"
+#include "zyla.h"
+#include "uevareplaysource.h"
+
+CameraCounters::CameraCounters()
+{
+	received = 0;
+	dropped = 0;
+	overwritten = 0;
+	overflows = 0;
+}
+
+UevaFramePool CameraThread::grayPool(GRAY_POOL_SIZE);
 
 CameraThread::CameraThread(QObject *parent)
 	: QThread(parent)
 {
 	mutex.lock();
-	settings = ZylaSettings();
 	cameraConnected = 0;
 	cameraAcquiring = 0;
-	currentImage = cv::Mat(0, 0, CV_16UC1);
+	framePending.storeRelease(0);
+	parallelUnpack.storeRelease(0);
+	currentImage = cv::Mat(0, 0, CV_8UC1);
 	mutex.unlock();
 }
 
 CameraThread::~CameraThread()
 {
-	mutex.lock();
-	deleteCamera();
-	mutex.unlock();
+	if (cameraConnected)
+	{
+		deleteCamera();
+	}
 }
 
 void CameraThread::getCurrentImage(cv::Mat &image)
 {
+	UevaFrameInfo info;
+	getCurrentImage(image, info);
+}
+
+void CameraThread::getCurrentImage(cv::Mat &image, UevaFrameInfo &info)
+{
+	//// share newest frame, run never writes into it after handing it over
 	mutex.lock();
-	//// make 8 bit clone out of 16 bit 
-	currentImage.convertTo(image, CV_8UC1, 0.00390625); // alpha = 1 / (2^16 / 2^8)
-	//currentImage = Mat(0, 0, CV_16UC1); // test if converTo does cloning
-	//image = currentImage.clone(); // test speed 16 bit vs 8 bit
+	image = currentImage;
+	image.allocator = 0; // buffer still goes back to pool, it keeps its own allocator
+	info = currentInfo;
+	framePending.storeRelease(0);
 	mutex.unlock();
 }
 
-void CameraThread::addCamera()
+CameraCounters CameraThread::getCounters()
 {
 	mutex.lock();
-	camera = new Zyla(0);
-	cameraConnected = 1;
+	CameraCounters c = counters;
 	mutex.unlock();
+	return c;
+}
+
+void CameraThread::addCamera(const bool replay)
+{
+	cameraMutex.lock();
+#ifndef UEVA_NO_ANDOR
+	if (!replay)
+	{
+		camera = new Zyla(0);
+	}
+	else
+#endif
+	{
+		camera = new UevaReplaySource();
+	}
+	cameraConnected = 1;
+	cameraMutex.unlock();
 }
 
 void CameraThread::deleteCamera()
 {
-	mutex.lock();
+	cameraMutex.lock();
 	delete camera;
 	cameraConnected = 0;
-	mutex.unlock();	
+	cameraMutex.unlock();	
 }
 
 QMap<QString, QString> CameraThread::defaultSettings()
 {
-	mutex.lock();
-	settings = ZylaSettings();
-	mutex.unlock();
-	return settings.allMap;
+	cameraMutex.lock();
+	if (cameraConnected)
+	{
+		settings = camera->defaultSettings();
+	}
+	cameraMutex.unlock();
+	return settings;
 }
 
 QMap<QString, QString> CameraThread::getSettings()
 {
-	mutex.lock();
+	cameraMutex.lock();
 	if (cameraConnected)
 	{
-		camera->get(settings);
-		settings.collapse();
+		settings = camera->getSettings();
 	}
-	mutex.unlock();
-	return settings.allMap;
+	cameraMutex.unlock();
+	return settings;
 }
 
 void CameraThread::setSettings(QMap<QString, QString> &s)
 {
-	mutex.lock();
+	cameraMutex.lock();
 	if (cameraConnected)
 	{
-		settings.allMap = s;
-		settings.expand();
-		settings.print();
-		camera->set(settings);
+		settings = s;
+		camera->setSettings(settings);
 	}
-	mutex.unlock();
+	cameraMutex.unlock();
 }
 
-void CameraThread::startCamera(const int &Ts)
+void CameraThread::startCamera(const int &periodMs)
 {
+	cameraMutex.lock();
+	camera->start(periodMs);
+	cv::Size_<int> size = camera->frameSize();
+	grayPool.reserve((size_t)size.area());
 	mutex.lock();
-	camera->start(Ts);
-	cameraAcquiring = 1;
+	counters = CameraCounters();
 	mutex.unlock();
+	cameraAcquiring = 1;
+	acquisitionStarted.wakeAll();
+	cameraMutex.unlock();
 }
 
 void CameraThread::stopCamera()
 {
-	mutex.lock();
+	cameraMutex.lock();
 	camera->stop();
 	cameraAcquiring = 0;
-	currentImage = cv::Mat(0, 0, CV_16UC1);
+	cameraMutex.unlock();
+	mutex.lock();
+	currentImage = cv::Mat(0, 0, CV_8UC1);
+	currentInfo = UevaFrameInfo();
+	framePending.storeRelease(0);
 	mutex.unlock();
 }
 
+bool CameraThread::cropAoi(cv::Rect_<int> &roi)
+{
+	cameraMutex.lock();
+	bool ok = cameraConnected && !cameraAcquiring && camera->cropAoi(roi);
+	cameraMutex.unlock();
+	return ok;
+}
+
+void CameraThread::setParallelUnpack(const bool parallel)
+{
+	parallelUnpack.storeRelease(parallel ? 1 : 0);
+}
+
 void CameraThread::run()
 {
+	cv::Mat image;
 	forever
 	{
+		cameraMutex.lock();
+		if (!cameraAcquiring)
+		{
+			// sleep until started instead of spinning
+			acquisitionStarted.wait(&cameraMutex);
+			cameraMutex.unlock();
+			continue;
+		}
+		if (camera->holdsFrames() && framePending.loadAcquire())
+		{
+			// previous frame not taken yet, source waits instead of losing it
+			cameraMutex.unlock();
+			msleep(1);
+			continue;
+		}
+		image.allocator = &grayPool;
+		bool isNewFrame = camera->processGray(image, WAIT_TIMEOUT, parallelUnpack.loadAcquire() != 0);
+		UevaFrameInfo info = camera->frameInfo();
+		qint64 dropped = camera->droppedFrames();
+		int overflows = camera->overflows();
+		cameraMutex.unlock();
+		if (!isNewFrame)
+		{
+			mutex.lock();
+			counters.overflows = overflows;
+			mutex.unlock();
+			yieldCurrentThread(); // let start stop and settings take camera
+			continue;
+		}
+
 		mutex.lock();
-		if (cameraAcquiring)
+		if (framePending.loadAcquire())
 		{
-			camera->process(currentImage);
-			//qDebug() <<
-			//	currentImage.total() << " " <<
-			//	currentImage.type() << " " << // 0 means CV_8U
-			//	currentImage.rows << " " <<
-			//	currentImage.cols << " " <<
-			//	currentImage.isContinuous() << endl;;
+			counters.overwritten++; // gui never took previous frame
 		}
+		counters.received++;
+		counters.dropped = dropped;
+		counters.overflows = overflows;
+		currentImage = image;
+		currentInfo = info;
 		mutex.unlock();
+		image.release(); // process takes next pool buffer, never shares with currentImage
+		//qDebug() <<
+		//	currentImage.total() << " " <<
+		//	currentImage.type() << " " << // 0 means CV_8U
+		//	currentImage.rows << " " <<
+		//	currentImage.cols << " " <<
+		//	currentImage.isContinuous() << endl;;
+		if (framePending.testAndSetOrdered(0, 1))
+		{
+			emit frameReady();
+		}
 	}
-}
\ No newline at end of file
+}
@@ -27,8 +27,21 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 #include <QImage > 
 #include <QThread >
 #include <QMutex >
+#include <QWaitCondition >
+#include <QAtomicInt >
 
-#include "zyla.h"
+#include "uevaframesource.h"
+#include "uevaframepool.h"
+
+struct CameraCounters
+{
+	CameraCounters();
+
+	qint64 received; // frames taken from ring since start
+	qint64 dropped; // made by camera but never reached ring, -1 when camera can not tell
+	qint64 overwritten; // replaced by newer frame before gui took them
+	int overflows; // ring ran out of buffers
+};
 
 class CameraThread : public QThread
 {
@@ -38,27 +51,47 @@ public:
 	CameraThread(QObject *parent = 0);
 	~CameraThread();
 
+	// image shares pool buffer, allocator is reset so creating image again never takes a pool buffer
 	void getCurrentImage(cv::Mat &image);
-	void addCamera();
+	void getCurrentImage(cv::Mat &image, UevaFrameInfo &info);
+	CameraCounters getCounters();
+	void addCamera(const bool replay = false); // replay reads recorded frames, only choice without andor sdk
 	void deleteCamera();
 	QMap<QString, QString> defaultSettings();
 	QMap<QString, QString> getSettings();
 	void setSettings(QMap<QString, QString> &s);
-	void startCamera(const int &Ts);
+	void startCamera(const int &periodMs); // sample period in ms, sizes camera ring
 	void stopCamera();
+	void setParallelUnpack(const bool parallel);
+	bool cropAoi(cv::Rect_<int> &roi); // camera stopped, roi in current image coordinates
 
 signals:
+	// newest frame replaced, emitted again only after getCurrentImage took it
+	void frameReady();
 
 protected:
 	void run();
 
 private:
-	Zyla *camera;
-	ZylaSettings settings;
+	UevaFrameSource *camera;
+	QMap<QString, QString> settings; // as last shown in setup tree
 	int cameraConnected;
 	int cameraAcquiring;
-	QMutex mutex;
-	cv::Mat currentImage;
+	QMutex mutex; // current image, held briefly
+	QMutex cameraMutex; // camera calls, held by run while waiting for frame
+	QWaitCondition acquisitionStarted;
+	QAtomicInt framePending;
+	QAtomicInt parallelUnpack;
+	cv::Mat currentImage; // 8 bit, unpacked by run straight from camera buffer
+	UevaFrameInfo currentInfo;
+	CameraCounters counters; // under mutex
+	static UevaFramePool grayPool; // 8 bit frames shared by engine, display and recorder, outlives every thread holding one
+
+	enum CameraConstants
+	{
+		WAIT_TIMEOUT = 100, // ms, bounds how long start stop and settings wait for run
+		GRAY_POOL_SIZE = 12, // gui, engine, pipeline queues and recorder
+	};
 
 	private slots:
 
@@ -294,7 +294,7 @@ void MainWindow::connectCamera()
 	{
 		setup->connectCameraButton->setText(tr("Disconnect"));
 		//// new camera
-		cameraThread->addCamera();
+		cameraThread->addCamera(replayAction->isChecked());
 		//// erase settings
 		while (int numItem = setup->cameraTree->topLevelItemCount())
 		{
@@ -346,7 +346,7 @@ void MainWindow::cameraOnOff()
 	{
 		setup->cameraButton->setText(tr("Off"));
 		settings.flag |= UevaSettings::CAMERA_ON;
-		cameraThread->startCamera((int)(timerInterval / 1000));
+		cameraThread->startCamera(timerInterval); // ring sized in ms
 	}
 	else
 	{
@@ -583,41 +583,68 @@ void MainWindow::timerEvent(QTimerEvent *event)
 	
 	if (event->timerId() == timerId)
 	{
-		//// PING
-		QTime now = QTime::currentTime();
-		pingTimeStamps.enqueue(now);
-		
-		//// INTERUPT CAMERA THREAD
-		cv::Mat temp8uc1;
-		if (settings.flag & UevaSettings::CAMERA_ON)
+		// camera drives engine instead when frame triggered
+		if (!((settings.flag & UevaSettings::FRAME_TRIGGERED) &&
+			(settings.flag & UevaSettings::CAMERA_ON)))
 		{
-			cameraThread->getCurrentImage(temp8uc1); // 16uc1 to 8uc1, 1 deep copy
+			tickEngine();
 		}
-		else
-		{
-			temp8uc1 = file8uc1.clone(); // 1 deep copy
-		}
-		videoWriterSize = temp8uc1.size();
+	}
+}
 
-		//// COLLECT SETTINGS (SOME ARE ALREADY SET THROUG SIGNAL SLOT)
-		settings.rightPressPosition = display->getRightPress();
-		settings.leftPressPosition = display->getLeftPress();
-		settings.leftPressMovement = display->getLeftPressMovement();
+void MainWindow::tickEngine()
+{
+	//// PING
+	QTime now = QTime::currentTime();
+	pingTimeStamps.enqueue(now);
+	
+	//// INTERUPT CAMERA THREAD
+	cv::Mat temp8uc1;
+	UevaFrameInfo frameInfo;
+	if (settings.flag & UevaSettings::CAMERA_ON)
+	{
+		cameraThread->getCurrentImage(temp8uc1, frameInfo); // shares 8uc1 unpacked by camera thread, no copy
+		cameraCounters = cameraThread->getCounters();
+	}
+	else
+	{
+		temp8uc1 = file8uc1.clone(); // 1 deep copy
+	}
+	videoWriterSize = temp8uc1.size();
 
-		//// CREATE AN EMPTY DATA STRUCTURE 
-		UevaData data = UevaData();
-		data.rawGray = temp8uc1;
+	//// COLLECT SETTINGS (SOME ARE ALREADY SET THROUG SIGNAL SLOT)
+	settings.rightPressPosition = display->getRightPress();
+	settings.leftPressPosition = display->getLeftPress();
+	settings.leftPressMovement = display->getLeftPressMovement();
 
-		//// WAKE ENGINE THREAD
-		engineThread->setSettings(settings); 
+	//// CREATE AN EMPTY DATA STRUCTURE 
+	UevaData data = UevaData();
+	data.rawGray = temp8uc1;
+	if (settings.flag & UevaSettings::CAMERA_ON)
+	{
+		// recorded with every cycle, so missed events can be matched against lost frames
+		data.map["cameraFrame"] = QVector<qreal>()
+			<< (qreal)frameInfo.sequence
+			<< frameInfo.timestamp
+			<< frameInfo.hostNs / 1.0e9;
+		data.map["cameraLost"] = QVector<qreal>()
+			<< (qreal)cameraCounters.dropped
+			<< (qreal)cameraCounters.overwritten
+			<< (qreal)cameraCounters.overflows;
+	}
+
+	//// QUEUE FRAME TO PIPELINE, OR WAKE ENGINE THREAD
+	if (!engineThread->pushFrame(settings, data))
+	{
+		engineThread->setSettings(settings);
 		engineThread->setData(data);
 		engineThread->wake();
-
-		//// ENGINE THREAD FPS
-		now = QTime::currentTime();
-		engineFps = 1000.0 / engineLastTime.msecsTo(now);
-		engineLastTime = now;
 	}
+
+	//// ENGINE THREAD FPS
+	now = QTime::currentTime();
+	engineFps = 1000.0 / engineLastTime.msecsTo(now);
+	engineLastTime = now;
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
@@ -811,6 +838,16 @@ void MainWindow::createActions()
 	connect(saveAsAction, SIGNAL(triggered()), 
 		this, SLOT(saveAs()));
 
+	replayAction = new QAction(tr("replay Camera"), this);
+	replayAction->setStatusTip(tr("Connect camera to recorded frames instead of hardware, file and pacing in camera settings"));
+	replayAction->setCheckable(true);
+#ifdef UEVA_NO_ANDOR
+	replayAction->setChecked(true); // only source without andor sdk
+	replayAction->setEnabled(false);
+#else
+	replayAction->setChecked(false);
+#endif
+
 	exitAction = new QAction(tr("E&xit"), this);
 	exitAction->setIcon(QIcon("icon/exit.png"));
 	exitAction->setShortcut(tr("Ctrl+Q"));
@@ -906,6 +943,73 @@ void MainWindow::createActions()
 	scaleUpAction->setShortcutContext(Qt::ApplicationShortcut);
 	connect(scaleUpAction, SIGNAL(triggered()),
 		this, SLOT(scaleUpImage()));
+
+	// droplets are never split across tiles, channels closer than two tile halos share one tile
+	tileAction = new QAction(tr("tile Imgproc"), this);
+	tileAction->setStatusTip(tr("Process channel regions in parallel instead of whole frame, only when channels are well apart"));
+	tileAction->setCheckable(true);
+	tileAction->setChecked(false);
+	connect(tileAction, SIGNAL(triggered()),
+		this, SLOT(tileImgproc()));
+
+	adaptBkgdAction = new QAction(tr("adapt Background"), this);
+	adaptBkgdAction->setStatusTip(tr("Slowly learn background from pixels without droplet or marker"));
+	adaptBkgdAction->setCheckable(true);
+	adaptBkgdAction->setChecked(false);
+	connect(adaptBkgdAction, SIGNAL(triggered()),
+		this, SLOT(adaptBkgd()));
+
+	pipelineAction = new QAction(tr("pipeline Engine"), this);
+	pipelineAction->setStatusTip(tr("Segment next frame while current frame is controlled and drawn"));
+	pipelineAction->setCheckable(true);
+	pipelineAction->setChecked(false);
+	connect(pipelineAction, SIGNAL(triggered()),
+		this, SLOT(pipelineEngine()));
+
+	optimalTrackAction = new QAction(tr("optimal Tracking"), this);
+	optimalTrackAction->setStatusTip(tr("Resolve crowded markers by global assignment instead of leaving them new"));
+	optimalTrackAction->setCheckable(true);
+	optimalTrackAction->setChecked(false);
+	connect(optimalTrackAction, SIGNAL(triggered()),
+		this, SLOT(optimalTracking()));
+
+	windowTrackAction = new QAction(tr("window Tracking"), this);
+	windowTrackAction->setStatusTip(tr("Search controlled markers only around predicted positions, full frame periodically"));
+	windowTrackAction->setCheckable(true);
+	windowTrackAction->setChecked(false);
+	connect(windowTrackAction, SIGNAL(triggered()),
+		this, SLOT(windowTracking()));
+
+	steadyKalmanAction = new QAction(tr("steady Kalman"), this);
+	steadyKalmanAction->setStatusTip(tr("Use steady state Kalman gain solved once per controller instead of propagating covariance"));
+	steadyKalmanAction->setCheckable(true);
+	steadyKalmanAction->setChecked(false);
+	connect(steadyKalmanAction, SIGNAL(triggered()),
+		this, SLOT(steadyKalman()));
+
+	frameTriggerAction = new QAction(tr("frame Trigger"), this);
+	frameTriggerAction->setStatusTip(tr("Run engine as soon as camera delivers a frame instead of on timer"));
+	frameTriggerAction->setCheckable(true);
+	frameTriggerAction->setChecked(false);
+	connect(frameTriggerAction, SIGNAL(triggered()),
+		this, SLOT(frameTrigger()));
+
+	parallelUnpackAction = new QAction(tr("parallel Unpack"), this);
+	parallelUnpackAction->setStatusTip(tr("Split unpacking of camera frames to 8 bit over worker threads by rows"));
+	parallelUnpackAction->setCheckable(true);
+	parallelUnpackAction->setChecked(false);
+	connect(parallelUnpackAction, SIGNAL(triggered()),
+		this, SLOT(parallelUnpack()));
+
+	fitAoiAction = new QAction(tr("fit AOI"), this);
+	fitAoiAction->setStatusTip(tr("Crop camera readout to separated channels, background and masks follow"));
+	connect(fitAoiAction, SIGNAL(triggered()),
+		this, SLOT(fitAoi()));
+
+	dumpProfileAction = new QAction(tr("dump Profile"), this);
+	dumpProfileAction->setStatusTip(tr("Write per stage engine timing of recent cycles to record folder"));
+	connect(dumpProfileAction, SIGNAL(triggered()),
+		this, SLOT(dumpProfile()));
 }
 
 void MainWindow::createMenus()
@@ -916,6 +1020,8 @@ void MainWindow::createMenus()
 	fileMenu->addAction(saveAction);
 	fileMenu->addAction(saveAsAction);
 	fileMenu->addSeparator();
+	fileMenu->addAction(replayAction);
+	fileMenu->addSeparator();
 	fileMenu->addAction(exitAction);
 
 	viewMenu = menuBar()->addMenu(tr("&View"));
@@ -932,6 +1038,19 @@ void MainWindow::createMenus()
 	visibilitySubMenu->addAction(scaleDownAction);
 	visibilitySubMenu->addAction(scaleUpAction);
 
+	engineMenu = menuBar()->addMenu(tr("&Engine"));
+	engineMenu->addAction(tileAction);
+	engineMenu->addAction(adaptBkgdAction);
+	engineMenu->addAction(pipelineAction);
+	engineMenu->addAction(optimalTrackAction);
+	engineMenu->addAction(windowTrackAction);
+	engineMenu->addAction(steadyKalmanAction);
+	engineMenu->addAction(frameTriggerAction);
+	engineMenu->addAction(parallelUnpackAction);
+	engineMenu->addSeparator();
+	engineMenu->addAction(fitAoiAction);
+	engineMenu->addAction(dumpProfileAction);
+
 	helpMenu = menuBar()->addMenu(tr("&Help"));
 	helpMenu->addAction(aboutAction);
 }
@@ -962,14 +1081,18 @@ void MainWindow::createStatusBar()
 	pumpFpsLabel = new QLabel;
 	pumpDutyCycleLabel = new QLabel;
 	pingLabel = new QLabel;
+	cameraLabel = new QLabel;
 	mousePositionLabel = new QLabel;
+	profileLabel = new QLabel;
 
 	statusBar()->addWidget(engineFpsLabel,1);
 	statusBar()->addWidget(engineDutyCycleLabel,1);
 	statusBar()->addWidget(pumpFpsLabel,1);
 	statusBar()->addWidget(pumpDutyCycleLabel,1);
 	statusBar()->addWidget(pingLabel,1);
+	statusBar()->addWidget(cameraLabel,1);
 	statusBar()->addWidget(mousePositionLabel,1);
+	statusBar()->addWidget(profileLabel,2);
 }
 
 void MainWindow::createThreads()
@@ -994,6 +1117,12 @@ void MainWindow::createThreads()
 		SLOT(pumpSlot(const UevaData &)),
 		Qt::QueuedConnection);
 
+	connect(cameraThread,
+		SIGNAL(frameReady()),
+		this,
+		SLOT(cameraSlot()),
+		Qt::QueuedConnection);
+
 }
 
 void MainWindow::startTimers()
@@ -1171,9 +1300,15 @@ void MainWindow::updateStatusBar()
 		.arg(QString::number(pumpDutyCycle * 100.0)));
 	pingLabel->setText(tr("Ping: %1")
 		.arg(QString::number(ping)));
+	cameraLabel->setText(tr("Frames: %1 Dropped: %2 Overwritten: %3 Overflows: %4")
+		.arg(QString::number(cameraCounters.received))
+		.arg(cameraCounters.dropped >= 0 ? QString::number(cameraCounters.dropped) : tr("n/a"))
+		.arg(QString::number(cameraCounters.overwritten))
+		.arg(QString::number(cameraCounters.overflows)));
 	mousePositionLabel->setText(tr("X: %1	Y: %2")
 		.arg(QString::number(mousePosition.x()))
 		.arg(QString::number(mousePosition.y())));
+	profileLabel->setText(engineThread->getProfile());
 }
 
 void MainWindow::showAndHideSetup()
@@ -1238,6 +1373,114 @@ void MainWindow::scaleUpImage()
 	if (settings.displayScale < 1.0) settings.displayScale += inc;
 }
 
+void MainWindow::tileImgproc()
+{
+	if (tileAction->isChecked())
+		settings.flag |= UevaSettings::IMGPROC_TILED;
+	else
+		settings.flag ^= UevaSettings::IMGPROC_TILED;
+}
+
+void MainWindow::adaptBkgd()
+{
+	if (adaptBkgdAction->isChecked())
+		settings.flag |= UevaSettings::BKGD_ADAPTIVE;
+	else
+		settings.flag ^= UevaSettings::BKGD_ADAPTIVE;
+}
+
+void MainWindow::pipelineEngine()
+{
+	if (pipelineAction->isChecked())
+		settings.flag |= UevaSettings::ENGINE_PIPELINED;
+	else
+		settings.flag ^= UevaSettings::ENGINE_PIPELINED;
+}
+
+void MainWindow::optimalTracking()
+{
+	if (optimalTrackAction->isChecked())
+		settings.flag |= UevaSettings::TRACK_OPTIMAL;
+	else
+		settings.flag ^= UevaSettings::TRACK_OPTIMAL;
+}
+
+void MainWindow::windowTracking()
+{
+	if (windowTrackAction->isChecked())
+		settings.flag |= UevaSettings::TRACK_WINDOWED;
+	else
+		settings.flag ^= UevaSettings::TRACK_WINDOWED;
+}
+
+void MainWindow::steadyKalman()
+{
+	if (steadyKalmanAction->isChecked())
+		settings.flag |= UevaSettings::CTRL_STEADY;
+	else
+		settings.flag ^= UevaSettings::CTRL_STEADY;
+}
+
+void MainWindow::frameTrigger()
+{
+	if (frameTriggerAction->isChecked())
+		settings.flag |= UevaSettings::FRAME_TRIGGERED;
+	else
+		settings.flag ^= UevaSettings::FRAME_TRIGGERED;
+}
+
+void MainWindow::parallelUnpack()
+{
+	if (parallelUnpackAction->isChecked())
+		settings.flag |= UevaSettings::UNPACK_PARALLEL;
+	else
+		settings.flag ^= UevaSettings::UNPACK_PARALLEL;
+	cameraThread->setParallelUnpack(parallelUnpackAction->isChecked());
+}
+
+void MainWindow::fitAoi()
+{
+	if (!(settings.flag & UevaSettings::CAMERA_ON) ||
+		(settings.flag & (UevaSettings::IMGPROC_ON | UevaSettings::CTRL_ON |
+		UevaSettings::RECORD_RAW | UevaSettings::RECORD_DRAWN)))
+	{
+		// tracking and open video writers assume frame size stays
+		statusBar()->showMessage(tr("Fit AOI needs camera on, image processing and recording off"), 2000);
+		return;
+	}
+	cv::Rect_<int> aoi;
+	if (!engineThread->channelBounds(aoi))
+	{
+		statusBar()->showMessage(tr("Fit AOI needs background and separated channels"), 2000);
+		return;
+	}
+	// aoi is only writable while not acquiring
+	cameraThread->stopCamera();
+	bool ok = cameraThread->cropAoi(aoi);
+	cameraThread->startCamera(timerInterval); // ring sized in ms
+	if (ok)
+	{
+		engineThread->cropToAoi(aoi);
+		statusBar()->showMessage(tr("AOI fitted"), 2000);
+	}
+	else
+	{
+		statusBar()->showMessage(tr("AOI not fitted"), 2000);
+	}
+}
+
+void MainWindow::dumpProfile()
+{
+	QDateTime now = QDateTime::currentDateTime();
+	QString filename = "record/ueva_profile_";
+	filename.append(now.toString("yyyy_MM_dd_HH_mm_ss"));
+	filename.append(".csv");
+	if (engineThread->dumpProfile(filename.toStdString()))
+		statusBar()->showMessage(tr("Profile saved"), 2000);
+	else
+		statusBar()->showMessage(tr("Profile not saved"), 2000);
+}
+
 //// THREAD FUNCTIONS
 void MainWindow::engineSlot(const UevaData &data)
 {
@@ -1271,6 +1514,16 @@ void MainWindow::engineSlot(const UevaData &data)
 	pumpLastTime = now;
 }
 
+void MainWindow::cameraSlot()
+{
+	//// NEW FRAME, TICK ENGINE WHEN FRAME TRIGGERED
+	if ((settings.flag & UevaSettings::FRAME_TRIGGERED) &&
+		(settings.flag & UevaSettings::CAMERA_ON))
+	{
+		tickEngine();
+	}
+}
+
 void MainWindow::pumpSlot(const UevaData &data)
 {
 	//// PUMPTHREAD DUTY CYCLE
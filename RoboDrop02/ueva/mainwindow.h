@@ -128,6 +128,7 @@ private:
 	void setCurrentFile(const QString &filename); // keep track of current image file and update title
 	void readSettings();
 	void writeSettings(); 
+	void tickEngine(); // grab newest frame and hand it to engine
 	
 	//// TIMING VARIABLES
 	int timerInterval; // sampling period right here
@@ -151,6 +152,7 @@ private:
 	PumpThread *pumpThread;
 
 	//// THREAD VARIABLES
+	CameraCounters cameraCounters; // as of last frame taken
 	UevaSettings settings;
 	int dataId;
 	UevaBuffer buffer;
@@ -176,10 +178,13 @@ private:
 	QLabel *pumpFpsLabel;
 	QLabel *pumpDutyCycleLabel;
 	QLabel *pingLabel;
+	QLabel *cameraLabel;
 	QLabel *mousePositionLabel;
+	QLabel *profileLabel;
 
 	QMenu *fileMenu;
 	QMenu *viewMenu;
+	QMenu *engineMenu;
 	QMenu *helpMenu;
 	QMenu *visibilitySubMenu;
 
@@ -189,6 +194,7 @@ private:
 	QAction *openAction;
 	QAction *saveAction;
 	QAction *saveAsAction;
+	QAction *replayAction;
 	QAction *exitAction;
 	QAction *aboutAction;
 	QAction *setupAction;
@@ -202,6 +208,16 @@ private:
 	QAction *dropRefAction;
 	QAction *scaleDownAction;
 	QAction *scaleUpAction;
+	QAction *tileAction;
+	QAction *adaptBkgdAction;
+	QAction *pipelineAction;
+	QAction *optimalTrackAction;
+	QAction *windowTrackAction;
+	QAction *steadyKalmanAction;
+	QAction *frameTriggerAction;
+	QAction *parallelUnpackAction;
+	QAction *fitAoiAction;
+	QAction *dumpProfileAction;
 
 	private slots:
 
@@ -221,10 +237,21 @@ private:
 	void showAndHideMarker();
 	void scaleDownImage();
 	void scaleUpImage();
+	void tileImgproc();
+	void adaptBkgd();
+	void pipelineEngine();
+	void optimalTracking();
+	void windowTracking();
+	void steadyKalman();
+	void frameTrigger();
+	void parallelUnpack();
+	void fitAoi();
+	void dumpProfile();
 
 	//// TRIGGERED BY THREADS
 	void engineSlot(const UevaData &data);
 	void pumpSlot(const UevaData &data);
+	void cameraSlot();
 };
 
 #endif //MAINWINDOW_H
\ No newline at end of file
@@ -24,7 +24,15 @@ S2EngineThread::S2EngineThread(QObject *parent)
 {
 	mutex.lock();
 	idle = true;
+	frameSequence = 0;
+	lastSequence = -1;
+	skippedResults = 0;
+	windowedCycles = 0;
+	micronPerPixel = 0;
+	maskLevels.push_back(MID_VALUE);
+	maskLevels.push_back(HIGH_VALUE);
 	mutex.unlock();
+	segmenter.start();
 }
 
 S2EngineThread::~S2EngineThread()
@@ -60,6 +68,24 @@ void S2EngineThread::wake()
 	mutex.unlock();
 }
 
+bool S2EngineThread::pushFrame(const UevaSettings &s, const UevaData &d)
+{
+	// never takes engine mutex, so next frame is segmented while engine works on this one
+	if (!(s.flag & UevaSettings::ENGINE_PIPELINED) ||
+		!(s.flag & UevaSettings::IMGPROC_ON) ||
+		(s.flag & (UevaSettings::MASK_MAKING | UevaSettings::CHANNEL_CUTTING)) ||
+		!segmenter.hasContext())
+	{
+		return false;
+	}
+	UevaFrame frame;
+	frame.sequence = frameSequence++;
+	frame.settings = s;
+	frame.data = d;
+	segmenter.pushFrame(frame);
+	return true;
+}
+
 
 
 //// SINGLE TIME
@@ -84,6 +110,8 @@ void S2EngineThread::setBkgd()
 	mutex.lock();
 
 	bkgd = data.rawGray.clone();
+	segmenter.resetBkgd(bkgd, channels);
+	publishContext();
 	qDebug() << "New Background" << endl;
 
 	mutex.unlock();
@@ -105,11 +133,18 @@ void S2EngineThread::separateChannels(int &numChan)
 	{
 		UevaChannel channel;
 		channel.index = i;
-		channel.mask = Ueva::contour2Mask(channelContours[i], allChannels.size());
 		channel.rect = cv::boundingRect(channelContours[i]);
+		channel.mask = Ueva::contour2Mask(channelContours[i], channel.rect);
 		channels.push_back(channel);
 	}
-
+	// one map for marker and droplet lookup
+	channelMap = Ueva::channels2Map(channels, allChannels.size());
+	if (!bkgd.empty())
+	{
+		// learnt region follows channels
+		segmenter.resetBkgd(bkgd, channels);
+	}
+	publishContext();
 
 	mutex.unlock();
 }
@@ -134,8 +169,90 @@ void S2EngineThread::sortChannels(std::map<std::string, std::vector<int> > &chan
 	channelContours.clear();
 	for (int i = 0; i < channels.size(); i++)
 	{
-		channelContours.push_back(Ueva::mask2Contour(channels[i].mask));
+		channelContours.push_back(Ueva::mask2Contour(channels[i].mask, channels[i].rect.tl()));
+	}
+	// map values follow new indices
+	channelMap = Ueva::channels2Map(channels, channelMap.size());
+	publishContext();
+
+	mutex.unlock();
+}
+
+bool S2EngineThread::channelBounds(cv::Rect_<int> &bounds)
+{
+	mutex.lock();
+
+	bool ok = !channels.empty() && !bkgd.empty();
+	if (ok)
+	{
+		bounds = channels[0].rect;
+		for (int i = 1; i < channels.size(); i++)
+		{
+			bounds |= channels[i].rect;
+		}
+		bounds = cv::Rect_<int>(bounds.x - AOI_MARGIN, bounds.y - AOI_MARGIN,
+			bounds.width + 2 * AOI_MARGIN, bounds.height + 2 * AOI_MARGIN) &
+			cv::Rect_<int>(cv::Point_<int>(0, 0), bkgd.size());
+	}
+
+	mutex.unlock();
+	return ok;
+}
+
+void S2EngineThread::cropToAoi(const cv::Rect_<int> &aoi)
+{
+	mutex.lock();
+
+	CV_Assert(!bkgd.empty());
+	CV_Assert((aoi & cv::Rect_<int>(cv::Point_<int>(0, 0), bkgd.size())) == aoi);
+	cv::Size_<int> oldSize = bkgd.size();
+
+	// new buffers, pipeline may still read old ones
+	bkgd = bkgd(aoi).clone();
+	if (!dropletMask.empty())
+	{
+		dropletMask = dropletMask(aoi).clone();
+	}
+	if (!markerMask.empty())
+	{
+		markerMask = markerMask(aoi).clone();
+	}
+	if (!allChannels.empty())
+	{
+		allChannels = allChannels(aoi).clone();
+	}
+	if (data.rawGray.size() == oldSize)
+	{
+		data.rawGray = data.rawGray(aoi).clone();
+	}
+
+	// channel geometry follows new origin
+	for (int i = 0; i < channels.size(); i++)
+	{
+		channels[i].rect -= aoi.tl();
+		CV_Assert((channels[i].rect & cv::Rect_<int>(cv::Point_<int>(0, 0), aoi.size())) == channels[i].rect);
+		channels[i].biggestDropletIndex = -1;
+		channels[i].measuringMarkerIndex = -1;
+		channels[i].neckDropletIndex = -1;
+	}
+	for (int i = 0; i < channelContours.size(); i++)
+	{
+		for (int j = 0; j < channelContours[i].size(); j++)
+		{
+			channelContours[i][j] -= aoi.tl();
+		}
 	}
+	channelMap = Ueva::channels2Map(channels, aoi.size());
+	segmenter.resetBkgd(bkgd, channels);
+
+	// markers were in old coordinates, tracking starts over
+	newMarkers.clear();
+	oldMarkers.clear();
+	activatedChannelIndices.clear();
+	windowedCycles = 0;
+	tiles.clear();
+	publishContext();
+	qDebug() << "Cropped to AOI" << aoi.x << aoi.y << aoi.width << aoi.height << endl;
 
 	mutex.unlock();
 }
@@ -203,7 +320,32 @@ void S2EngineThread::loadCtrl(std::string fileName,
 		std::cerr << "Wd " << ctrl.Wd << std::endl;
 		std::cerr << std::endl;
 	}
+	// full plant for designing controllers the file does not have
+	UevaPlant plant;
+	cv::FileNode plantNode = fs["plant"];
+	if (!plantNode.empty())
+	{
+		cv::Mat mat;
+		plantNode["A"] >> mat;
+		mat.convertTo(plant.A, CV_64FC1);
+		plantNode["B"] >> mat;
+		mat.convertTo(plant.B, CV_64FC1);
+		plantNode["C"] >> mat;
+		mat.convertTo(plant.C, CV_64FC1);
+		plantNode["D"] >> mat;
+		mat.convertTo(plant.D, CV_64FC1);
+		plantNode["isfbQ"] >> plant.isfbQ;
+		plantNode["obsrQ"] >> plant.obsrQ;
+		plant.isfbQIntegral = (double)plantNode["isfbQIntegral"];
+		plant.isfbR = (double)plantNode["isfbR"];
+		plant.obsrR = (double)plantNode["obsrR"];
+		CV_Assert(plant.A.rows == UevaCtrl::numPlantState && plant.B.cols == UevaCtrl::numPlantInput);
+		CV_Assert(plant.C.rows == UevaCtrl::numPlantOutput);
+		std::cerr << "plant loaded, controllers designed on demand" << std::endl;
+	}
 	fs.release();
+	Ueva::indexCtrls(ctrls, ctrlLookup);
+	ctrlCache.reset(plant, (int)ctrls.size(), CTRL_CACHE_SIZE);
 
 	mutex.unlock();
 }
@@ -225,6 +367,7 @@ void S2EngineThread::finalizeImgproc()
 	newMarkers.clear();
 	oldMarkers.clear();
 	activatedChannelIndices.clear();
+	windowedCycles = 0;
 	for (int i = 0; i < channels.size(); i++)
 	{
 		channels[i].biggestDropletIndex = -1;
@@ -240,7 +383,7 @@ void S2EngineThread::initCtrl()
 	mutex.lock();
 
 	CV_Assert(!channels.empty());
-	CV_Assert(!ctrls.empty());
+	CV_Assert(!ctrls.empty() || ctrlCache.isActive());
 	CV_Assert(!settings.inletRequests.empty());
 	
 	needSelecting = true;
@@ -272,7 +415,7 @@ void S2EngineThread::finalizeCtrl(QVector<qreal> &inletRegurgitates)
 	mutex.lock();
 
 	CV_Assert(!channels.empty());
-	CV_Assert(!ctrls.empty());
+	CV_Assert(!ctrls.empty() || ctrlCache.isActive());
 	CV_Assert(!settings.inletRequests.empty());
 	
 	needSelecting = false;
@@ -284,15 +427,80 @@ void S2EngineThread::finalizeCtrl(QVector<qreal> &inletRegurgitates)
 	mutex.unlock();
 }
 
+//// PROFILE
+QString S2EngineThread::getProfile()
+{
+	// separate mutex, gui never waits for a whole engine cycle
+	profileMutex.lock();
+	QString str = profiler.summary();
+	profileMutex.unlock();
+	return str;
+}
+
+bool S2EngineThread::dumpProfile(const std::string &fileName)
+{
+	profileMutex.lock();
+	bool ok = profiler.dump(fileName);
+	profileMutex.unlock();
+	return ok;
+}
+
+
+
+//// PIPELINE
+void S2EngineThread::publishContext()
+{
+	// called with engine mutex held, whenever background, masks or channels may have changed
+	segmenter.setContext(bkgd, markerMask, dropletMask, channels, TILE_HALO);
+}
+
+
+
+//// CTRL
+bool S2EngineThread::combinationPossible(std::vector<int> &combination, const int outerStage)
+{
+	profiler.begin(UevaProfiler::DESIGN);
+	bool possible = Ueva::isCombinationPossible(combination, ctrls, ctrlLookup, ctrlCache);
+	profiler.endNested(UevaProfiler::DESIGN, outerStage);
+	return possible;
+}
+
+void S2EngineThread::releaseChannel(const int channelIndex, const int outerStage)
+{
+	Ueva::deleteFromCombination(activatedChannelIndices, channelIndex);
+	if (!activatedChannelIndices.empty() && !combinationPossible(activatedChannelIndices, outerStage))
+	{
+		// remaining channels have no controller designed yet, release them too rather than run the old one
+		for (int i = 0; i < activatedChannelIndices.size(); i++)
+		{
+			channels[activatedChannelIndices[i]].measuringMarkerIndex = -1;
+			channels[activatedChannelIndices[i]].neckDropletIndex = -1;
+		}
+		activatedChannelIndices.clear();
+	}
+	needReleasing = true;
+}
+
+
+
 //// CONTINUOUS
 void S2EngineThread::run()
 {
 	forever
 	{
-		if (!idle)
+		// newest segmented frame from pipeline, older ones are stale for control
+		int numSegmented = segmenter.popNewest(segmented);
+		if (!idle || numSegmented)
 		{
 			mutex.lock();
-			//QTime entrance = QTime::currentTime();
+			profiler.startCycle();
+			if (numSegmented)
+			{
+				settings = segmented.settings;
+				data = segmented.data;
+				skippedResults += numSegmented - 1;
+				lastSequence = segmented.sequence;
+			}
 
 			//// OPEN LOOP
 			data.map["inletWrite"] = settings.inletRequests;
@@ -300,7 +508,13 @@ void S2EngineThread::run()
 			//// MASK MAKING
 			if (settings.flag & UevaSettings::MASK_MAKING)
 			{
+				profiler.begin(UevaProfiler::MASK);
 				CV_Assert(!bkgd.empty());
+				// pipeline may still read old mask, write into new buffer
+				if (dropletMask.u && dropletMask.u->refcount > 1)
+				{
+					dropletMask.release();
+				}
 				// detect walls with adaptive threshold (most time consuming)
 				cv::adaptiveThreshold(bkgd, dropletMask,
 					HIGH_VALUE,
@@ -318,27 +532,32 @@ void S2EngineThread::run()
 					seed.y = settings.mouseLines[0].y1() / settings.displayScale;
 				}
 				floodFillReturn = cv::floodFill(dropletMask, seed, MID_VALUE);
-				// eliminate noise and wall by manual morphological opening (second most time consuming)
-				structuringElement = cv::getStructuringElement(cv::MORPH_RECT,
-					cv::Size_<int>(settings.maskOpenSize + 3, settings.maskOpenSize + 3));
-				cv::erode(dropletMask, dropletMask, structuringElement);
-				structuringElement = cv::getStructuringElement(cv::MORPH_RECT,
-					cv::Size_<int>(settings.maskOpenSize, settings.maskOpenSize));
-				cv::dilate(dropletMask, dropletMask, structuringElement);
+				// eliminate noise and wall by manual morphological opening, on bit planes of flooded and other walls
+				Ueva::morphLevels(dropletMask, dropletMask, maskLevels,
+					cv::Size_<int>(settings.maskOpenSize + 3, settings.maskOpenSize + 3),
+					cv::Size_<int>(settings.maskOpenSize, settings.maskOpenSize),
+					maskPlanes);
 				// draw
 				cv::cvtColor(dropletMask, data.drawnBgr, CV_GRAY2BGR);
 				cv::cvtColor(data.drawnBgr, data.drawnRgb, CV_BGR2RGB);
 				cv::resize(data.drawnRgb, data.drawnRgb, cv::Size(), settings.displayScale, settings.displayScale, 1);
+				profiler.end(UevaProfiler::MASK);
 			}
 
 			//// CHANNEL CUTTING
 			else if (settings.flag & UevaSettings::CHANNEL_CUTTING)
 			{
+				profiler.begin(UevaProfiler::MASK);
 				CV_Assert(!dropletMask.empty());
+				if (markerMask.u && markerMask.u->refcount > 1)
+				{
+					markerMask.release();
+				}
 				// further erode to get thinner mask
-				structuringElement = cv::getStructuringElement(cv::MORPH_RECT,
-					cv::Size_<int>(settings.channelErodeSize, settings.channelErodeSize));
-				cv::erode(dropletMask, markerMask, structuringElement);
+				Ueva::morphLevels(dropletMask, markerMask, maskLevels,
+					cv::Size_<int>(settings.channelErodeSize, settings.channelErodeSize),
+					cv::Size_<int>(1, 1),
+					maskPlanes);
 				// cut into channels
 				allChannels = markerMask.clone();
 				for (int i = 1; i < settings.mouseLines.size(); i++)
@@ -357,6 +576,7 @@ void S2EngineThread::run()
 				cv::cvtColor(drawn, data.drawnBgr, CV_GRAY2BGR);
 				cv::cvtColor(data.drawnBgr, data.drawnRgb, CV_BGR2RGB);
 				cv::resize(data.drawnRgb, data.drawnRgb, cv::Size(), settings.displayScale, settings.displayScale, 1);
+				profiler.end(UevaProfiler::MASK);
 			}
 			else
 			{	
@@ -368,92 +588,111 @@ void S2EngineThread::run()
 					CV_Assert(!markerMask.empty());
 					CV_Assert(!channels.empty());
 
-					// background subtraction to get edges
-					cv::absdiff(data.rawGray, bkgd, allMarkers);
-					cv::threshold(allMarkers, allMarkers,
-						settings.imgprogThreshold,
-						HIGH_VALUE,
-						cv::THRESH_BINARY);
-					// flood and complement to get internals
-					allDroplets = allMarkers.clone();
-					seed = cv::Point(0, 0);
-					floodFillReturn = cv::floodFill(allDroplets, seed, HIGH_VALUE);
-					allDroplets = HIGH_VALUE - allDroplets;
-					// combine edges and internals to get whole droplets 
-					cv::bitwise_or(allMarkers, allDroplets, allDroplets);
-					// Exclude noise with masks
-					cv::bitwise_and(allMarkers, markerMask, allMarkers);
-					cv::bitwise_and(allDroplets, dropletMask, allDroplets);
-					// polish droplets with erosion for better kink detection
-					structuringElement = cv::getStructuringElement(cv::MORPH_RECT,
-						cv::Size_<int>(settings.imgprogErodeSize, settings.imgprogErodeSize));
-					cv::erode(allDroplets, allDroplets, structuringElement);
-					// find countours
-					dropletContours.clear();
-					markerContours.clear();
-					cv::findContours(allMarkers, markerContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
-					cv::findContours(allDroplets, dropletContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
-					// filter contours base on size	
-					Ueva::bigPassFilter(markerContours, settings.imgprogContourSize);
-					Ueva::bigPassFilter(dropletContours, settings.imgprogContourSize);
-
-					// vector of marker
-					newMarkers.clear();
-					for (int i = 0; i < markerContours.size(); i++)
+					// newest background learnt by segment thread, learning time reported with it
+					qint64 learnNs;
+					if ((settings.flag & UevaSettings::BKGD_ADAPTIVE) && segmenter.takeBkgd(bkgd, learnNs))
 					{
-						UevaMarker marker;
-						mom = cv::moments(markerContours[i]);
-						marker.centroid.x = mom.m10 / mom.m00;
-						marker.centroid.y = mom.m01 / mom.m00;
-						marker.rect = cv::Rect_<int>(
-							marker.centroid.x - settings.ctrlMarkerSize / 2,
-							marker.centroid.y - settings.ctrlMarkerSize / 2,
-							settings.ctrlMarkerSize,
-							settings.ctrlMarkerSize);
-						newMarkers.push_back(marker);
+						profiler.add(UevaProfiler::BKGD, learnNs);
 					}
-					
-					// old to new markers (object tracking)
-					Ueva::trackMarkerIdentities(newMarkers, oldMarkers, settings.imgprogTrackTooFar);
-					
-					// vector of droplet
-					droplets.clear();
-					for (int i = 0; i < dropletContours.size(); i++)
+
+					// follow controlled markers in small windows while nothing else needs the full frame
+					bool windowed = !numSegmented &&
+						(settings.flag & UevaSettings::TRACK_WINDOWED) &&
+						windowedCycles < WINDOW_FULL_PERIOD &&
+						settings.leftPressPosition.isNull();
+					followIndices.clear();
+					for (int i = 0; windowed && i < channels.size(); i++)
 					{
-						UevaDroplet droplet;
-						droplet.mask = Ueva::contour2Mask(dropletContours[i], allDroplets.size());
-						droplet.kinkIndex = Ueva::detectKink(dropletContours[i], settings.imgprocConvexSize);
-						if (droplet.kinkIndex != -1)
+						if (channels[i].measuringMarkerIndex != -1 && channels[i].neckDropletIndex == -1)
+						{
+							followIndices.push_back(channels[i].measuringMarkerIndex);
+						}
+						else if (channels[i].neckDropletIndex != -1 ||
+							settings.autoCatchRequests[i] ||
+							settings.useNeckRequests[i])
 						{
-							droplet.neckIndex = Ueva::detectNeck(dropletContours[i],
-								droplet.kinkIndex,
-								droplet.neckDistance,
-								settings.imgprocPersistence);
+							// neck needs droplets, auto catch needs every marker
+							windowed = false;
 						}
-						droplets.push_back(droplet);
 					}
-					if (UevaDroplet::fileStream.is_open())
+					if (windowed && !followIndices.empty())
 					{
-						UevaDroplet::fileStream << std::endl;
+						profiler.begin(UevaProfiler::TRACKING);
+						windowed = Ueva::trackMarkersInWindows(data.rawGray, bkgd, markerMask, settings,
+							oldMarkers, followIndices, windowEdges, windowMarkers, windowBlobs, windowCandidates, newMarkers);
+						profiler.end(UevaProfiler::TRACKING);
+					}
+					else
+					{
+						windowed = false;
 					}
 
-					// droplet to channel
-					for (int i = 0; i < channels.size(); i++)
+					if (windowed)
 					{
-						channels[i].biggestDropletIndex = -1;
-						int maxOverlap = 0;
-						for (int j = 0; j < droplets.size(); j++)
+						// droplets are not looked at until next full frame
+						windowedCycles++;
+						droplets.clear();
+						dropletContours.clear();
+						for (int i = 0; i < channels.size(); i++)
 						{
-							int overlap = Ueva::masksOverlap(droplets[j].mask, channels[i].mask);
-							if (overlap > maxOverlap)
-							{
-								maxOverlap = overlap;
-								channels[i].biggestDropletIndex = j;
-							}
+							channels[i].biggestDropletIndex = -1;
 						}
 					}
+					else
+					{
+						// periodic or fallback full frame
+						windowedCycles = 0;
+						if (numSegmented)
+						{
+							// already segmented by pipeline stage
+							allMarkers = segmented.allMarkers;
+							allDroplets = segmented.allDroplets;
+							newMarkers.swap(segmented.markers);
+							dropletContours.swap(segmented.dropletContours);
+						}
+						else
+						{
+							// segment channel regions, one tile per channel in parallel or one tile around all
+							Ueva::makeTiles(channels, data.rawGray.size(), TILE_HALO,
+								(settings.flag & UevaSettings::IMGPROC_TILED) != 0, tiles);
+							Ueva::segmentTiles(data.rawGray, bkgd, markerMask, dropletMask, settings, tiles);
+							Ueva::mergeTiles(tiles, data.rawGray.size(),
+								allMarkers, allDroplets, newMarkers, dropletContours);
+							Ueva::tileStageTimes(tiles, segmented.stageNs);
+						}
+						profiler.add(UevaProfiler::ABSDIFF, segmented.stageNs[UevaTile::SUBTRACT]);
+						profiler.add(UevaProfiler::FILL, segmented.stageNs[UevaTile::FILL]);
+						profiler.add(UevaProfiler::CONTOURS, segmented.stageNs[UevaTile::CONTOURS]);
+
+						// learn background away from droplets and markers on segment thread, pipelined frames learn there already
+						if ((settings.flag & UevaSettings::BKGD_ADAPTIVE) && !numSegmented)
+						{
+							segmenter.learnBkgd(data.rawGray, allDroplets, allMarkers, settings.bkgdRate);
+						}
+
+						// old to new markers (object tracking), markers already labelled during segmentation
+						profiler.begin(UevaProfiler::TRACKING);
+						Ueva::trackMarkerIdentities(newMarkers, oldMarkers, settings.imgprogTrackTooFar,
+							(settings.flag & UevaSettings::TRACK_OPTIMAL) != 0);
+						profiler.end(UevaProfiler::TRACKING);
+					
+						// vector of droplet
+						profiler.begin(UevaProfiler::KINK_NECK);
+						Ueva::analyseDroplets(dropletContours, settings, droplets, shapeScratches);
+						if (UevaDroplet::fileStream.is_open())
+						{
+							UevaDroplet::fileStream << std::endl;
+						}
+						profiler.end(UevaProfiler::KINK_NECK);
+
+						// droplet to channel
+						profiler.begin(UevaProfiler::TRACKING);
+						Ueva::dropletsToChannels(dropletContours, allDroplets, channelMap, dropletLabels, channels);
+						profiler.end(UevaProfiler::TRACKING);
+					}
 
 					// renew marker index base on identity and whether to keep using neck
+					profiler.begin(UevaProfiler::TRACKING);
 					for (int i = 0; i < channels.size(); i++)
 					{
 						// last cycle has marker
@@ -470,7 +709,7 @@ void S2EngineThread::run()
 							}
 							if (stillExistMarkerIndex != -1)
 							{
-								if (Ueva::isMarkerInChannel(newMarkers[stillExistMarkerIndex], channels[i], 0, 0))
+								if (Ueva::isMarkerInChannel(newMarkers[stillExistMarkerIndex], channels[i], channelMap, 0, 0))
 								{
 									// marker in channel 
 									channels[i].measuringMarkerIndex = stillExistMarkerIndex;
@@ -479,18 +718,14 @@ void S2EngineThread::run()
 								{
 									// marker escaped channel
 									channels[i].measuringMarkerIndex = -1;
-									Ueva::deleteFromCombination(activatedChannelIndices, i);
-									alwaysTrue = Ueva::isCombinationPossible(activatedChannelIndices, ctrls);
-									needReleasing = true;
+									releaseChannel(i, UevaProfiler::TRACKING);
 								}
 							}
 							else
 							{
 								// marker disappeared from image
 								channels[i].measuringMarkerIndex = -1;
-								Ueva::deleteFromCombination(activatedChannelIndices, i);
-								alwaysTrue = Ueva::isCombinationPossible(activatedChannelIndices, ctrls);
-								needReleasing = true;
+								releaseChannel(i, UevaProfiler::TRACKING);
 							}
 						}
 						// last cycle has neck
@@ -508,25 +743,23 @@ void S2EngineThread::run()
 								{
 									// neck no longer exist
 									channels[i].neckDropletIndex = -1;
-									Ueva::deleteFromCombination(activatedChannelIndices, i);
-									alwaysTrue = Ueva::isCombinationPossible(activatedChannelIndices, ctrls);
-									needReleasing = true;
+									releaseChannel(i, UevaProfiler::TRACKING);
 								}
 							}
 							else
 							{
 								// droplet disappeared from image or neck not used anymore
 								channels[i].neckDropletIndex = -1;
-								Ueva::deleteFromCombination(activatedChannelIndices, i);
-								alwaysTrue = Ueva::isCombinationPossible(activatedChannelIndices, ctrls);
-								needReleasing = true;
+								releaseChannel(i, UevaProfiler::TRACKING);
 							}
 						}
 					}
 					oldMarkers.clear();
 					oldMarkers = newMarkers;
+					profiler.end(UevaProfiler::TRACKING);
 
 					// user inputs
+					profiler.begin(UevaProfiler::INPUT);
 					mousePressLeft.x = settings.leftPressPosition.x() / settings.displayScale;
 					mousePressLeft.y = settings.leftPressPosition.y() / settings.displayScale;
 					mousePressRight.x = settings.rightPressPosition.x() / settings.displayScale;
@@ -542,38 +775,35 @@ void S2EngineThread::run()
 					{
 						if (mousePressLeft.inside(newMarkers[i].rect))
 						{
-							for (int j = 0; j < channels.size(); j++)
+							int j = Ueva::markerToChannel(newMarkers[i], channelMap);
+							if (j != -1)
 							{
-								if (Ueva::isMarkerInChannel(newMarkers[i], channels[j], 0, 0))
+								// channel already activated
+								if (channels[j].measuringMarkerIndex != -1 && channels[j].neckDropletIndex == -1)
 								{
-									// channel already activated
-									if (channels[j].measuringMarkerIndex != -1 && channels[j].neckDropletIndex == -1)
+									if (channels[j].measuringMarkerIndex == i)
 									{
-										if (channels[j].measuringMarkerIndex == i)
-										{
-											// same marker
-										}
-										else
-										{
-											// swap marker 
-											channels[j].measuringMarkerIndex = i;
-											needSelecting = true;
-										}
+										// same marker
 									}
-									// channel not activated
-									if (channels[j].measuringMarkerIndex == -1 && channels[j].neckDropletIndex == -1)
+									else
 									{
-										desiredChannelIndices = activatedChannelIndices;
-										desiredChannelIndices.push_back(j);
-										if (Ueva::isCombinationPossible(desiredChannelIndices, ctrls))
-										{
-											// activate channel
-											activatedChannelIndices = desiredChannelIndices;
-											channels[j].measuringMarkerIndex = i;
-											needSelecting = true;
-										}
+										// swap marker 
+										channels[j].measuringMarkerIndex = i;
+										needSelecting = true;
+									}
+								}
+								// channel not activated
+								if (channels[j].measuringMarkerIndex == -1 && channels[j].neckDropletIndex == -1)
+								{
+									desiredChannelIndices = activatedChannelIndices;
+									desiredChannelIndices.push_back(j);
+									if (combinationPossible(desiredChannelIndices, UevaProfiler::INPUT))
+									{
+										// activate channel
+										activatedChannelIndices = desiredChannelIndices;
+										channels[j].measuringMarkerIndex = i;
+										needSelecting = true;
 									}
-									break;
 								}
 							}
 						}
@@ -585,9 +815,7 @@ void S2EngineThread::run()
 								{
 									// deactivate channel
 									channels[j].measuringMarkerIndex = -1;
-									Ueva::deleteFromCombination(activatedChannelIndices, j);
-									alwaysTrue = Ueva::isCombinationPossible(activatedChannelIndices, ctrls);
-									needReleasing = true;
+									releaseChannel(j, UevaProfiler::INPUT);
 									break;
 								}
 							}
@@ -604,12 +832,12 @@ void S2EngineThread::run()
 						{
 							for (int j = 0; j < newMarkers.size(); j++)
 							{
-								if (Ueva::isMarkerInChannel(newMarkers[j], channels[i],
+								if (Ueva::isMarkerInChannel(newMarkers[j], channels[i], channelMap,
 									settings.ctrlAutoHorzExcl, settings.ctrlAutoVertExcl))
 								{
 									desiredChannelIndices = activatedChannelIndices;
 									desiredChannelIndices.push_back(i);
-									if (Ueva::isCombinationPossible(desiredChannelIndices, ctrls))
+									if (combinationPossible(desiredChannelIndices, UevaProfiler::INPUT))
 									{
 										// activate channel with marker
 										activatedChannelIndices = desiredChannelIndices;
@@ -632,7 +860,7 @@ void S2EngineThread::run()
 								{
 									desiredChannelIndices = activatedChannelIndices;
 									desiredChannelIndices.push_back(i);
-									if (Ueva::isCombinationPossible(desiredChannelIndices, ctrls))
+									if (combinationPossible(desiredChannelIndices, UevaProfiler::INPUT))
 									{
 										// activate channel with neck
 										activatedChannelIndices = desiredChannelIndices;
@@ -663,43 +891,44 @@ void S2EngineThread::run()
 					//	std::cerr << activatedChannelIndices[i] << " ";
 					//}
 					//std::cerr << std::endl;
+					profiler.end(UevaProfiler::INPUT);
 				}
 				//// CTRL
 				if (settings.flag & UevaSettings::CTRL_ON)
 				{
+					profiler.begin(UevaProfiler::KALMAN);
 					CV_Assert(!channels.empty());
-					CV_Assert(!ctrls.empty());
+					CV_Assert(!ctrls.empty() || ctrlCache.isActive());
 					CV_Assert(!settings.inletRequests.empty());
 
 					if (!activatedChannelIndices.empty())
 					{
-						UevaCtrl ctrl = ctrls[UevaCtrl::index];
-
 						// reset
-						if (needReleasing || needSelecting)
+						bool steady = (settings.flag & UevaSettings::CTRL_STEADY) != 0;
+						cv::Vec3d noise(settings.ctrlModelCov,
+							settings.ctrlDisturbanceCorr,
+							std::pow(micronPerPixel, 2) / 12.0);
+						UevaCtrl &ctrl = ctrls[UevaCtrl::index];
+						profiler.begin(UevaProfiler::DESIGN);
+						bool reset = needReleasing || needSelecting ||
+							ctrlKernel.index != UevaCtrl::index ||
+							ctrlKernel.steady != steady ||
+							(steady && ctrlKernel.noise != noise);
+						if (steady && ctrl.steadyNoise != noise)
 						{
-							posteriorErrorCov = 1000.0 * cv::Mat::eye(
-								ctrl.n + ctrl.m, ctrl.n + ctrl.m, CV_64FC1);
-
-							modelNoiseCov = settings.ctrlModelCov * cv::Mat::eye(
-								ctrl.n, ctrl.n,	CV_64FC1);
-
-							disturbanceNoiseCov = settings.ctrlDisturbanceCorr * cv::Mat::eye(
-								ctrl.m,	ctrl.m, CV_64FC1);
-
-							cv::Mat zerosNbyM = cv::Mat(ctrl.n,	ctrl.m,	CV_64FC1, cv::Scalar(0.0));
-
-							cv::Mat zerosMbyN = cv::Mat(ctrl.m,	ctrl.n,	CV_64FC1, cv::Scalar(0.0));
-
-							cv::Mat onesNbyNplusM;
-							cv::Mat onesMbyNplusM;
-							cv::hconcat(modelNoiseCov, zerosNbyM, onesNbyNplusM);
-							cv::hconcat(zerosMbyN, disturbanceNoiseCov, onesMbyNplusM);
-							cv::vconcat(onesNbyNplusM, onesMbyNplusM, processNoiseCov);
-							
-							sensorNoiseCov = std::pow(micronPerPixel, 2) / 12.0 * cv::Mat::eye(
-								ctrl.p, ctrl.p,	CV_64FC1);
+							// solved once per controller and noise setting when steady mode first selects it
+							if (!UevaCtrlKernel::solveSteadyGain(ctrl, noise[0], noise[1], noise[2], ctrl.steadyGain))
+							{
+								qDebug() << "no steady kalman gain, time varying filter used, controller " << UevaCtrl::index << endl;
+							}
+							ctrl.steadyNoise = noise;
+							reset = true;
 						}
+						if (reset)
+						{
+							ctrlKernel.select(ctrl, UevaCtrl::index, noise[0], noise[1], noise[2], steady);
+						}
+						profiler.endNested(UevaProfiler::DESIGN, UevaProfiler::KALMAN);
 						if (needReleasing)
 						{
 							reference = QVector<qreal>(UevaCtrl::numPlantOutput, 0.0);
@@ -716,42 +945,36 @@ void S2EngineThread::run()
 						}
 
 						// from previous
-						k = cv::Mat(ctrl.n + ctrl.m, ctrl.p, CV_64FC1, cv::Scalar(0.0));
-						pp = cv::Mat(ctrl.n + ctrl.m, ctrl.n + ctrl.m, CV_64FC1, cv::Scalar(0.0));
-						pe = posteriorErrorCov;
-						rw = processNoiseCov;
-						rv = sensorNoiseCov;
-
-						r = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						dr = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						y = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						y_raw = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						y_off = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						yk = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						yl = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						xp = cv::Mat(ctrl.n + ctrl.m, 1, CV_64FC1, cv::Scalar(0.0));
-						xe = cv::Mat(ctrl.n + ctrl.m, 1, CV_64FC1, cv::Scalar(0.0));
-						xl = cv::Mat(ctrl.n, 1, CV_64FC1, cv::Scalar(0.0));
-						z = cv::Mat(ctrl.p, 1, CV_64FC1, cv::Scalar(0.0));
-						u = cv::Mat(ctrl.m, 1, CV_64FC1, cv::Scalar(0.0));
-
-						for (int i = 0; i < ctrl.p; i++)
+						const int n = ctrlKernel.n;
+						const int m = ctrlKernel.m;
+						const int p = ctrlKernel.p;
+						std::vector<double> &r = ctrlKernel.r;
+						std::vector<double> &dr = ctrlKernel.dr;
+						std::vector<double> &y = ctrlKernel.y;
+						std::vector<double> &y_raw = ctrlKernel.yRaw;
+						std::vector<double> &y_off = ctrlKernel.yOff;
+						std::fill(dr.begin(), dr.end(), 0.0);
+						std::fill(y.begin(), y.end(), 0.0);
+						for (int i = 0; i < p; i++)
 						{
-							r.at<double>(i) = reference[ctrl.outputIndices.at<uchar>(i)];
-							y_raw.at<double>(i) = outputRaw[ctrl.outputIndices.at<uchar>(i)];
-							y_off.at<double>(i) = outputOffset[ctrl.outputIndices.at<uchar>(i)];
-							z.at<double>(i) = stateIntegral[ctrl.outputIndices.at<uchar>(i)];
+							int outputIndex = ctrlKernel.outputIndices[i];
+							r[i] = reference[outputIndex];
+							y_raw[i] = outputRaw[outputIndex];
+							y_off[i] = outputOffset[outputIndex];
+							ctrlKernel.z[i] = stateIntegral[outputIndex];
 						}
-						for (int i = 0; i < ctrl.n; i++)
+						for (int i = 0; i < n; i++)
 						{
-							xe.at<double>(i) = stateKalman[ctrl.stateIndices.at<uchar>(i)];
-							xl.at<double>(i) = stateLuenburger[ctrl.stateIndices.at<uchar>(i)];
+							int stateIndex = ctrlKernel.stateIndices[i];
+							ctrlKernel.xe[i] = stateKalman[stateIndex];
+							ctrlKernel.xl[i] = stateLuenburger[stateIndex];
 						}
-						for (int i = 0; i < ctrl.m; i++)
+						for (int i = 0; i < m; i++)
 						{
-							u.at<double>(i) = command[i];
-							xe.at<double>(i + ctrl.n) = disturbance[i];
+							ctrlKernel.u[i] = command[i];
+							ctrlKernel.xe[i + n] = disturbance[i];
 						}
+						CV_Assert((int)activatedChannelIndices.size() <= p);
 
 						// direct request
 						directRequestIndex = -1;
@@ -763,7 +986,7 @@ void S2EngineThread::run()
 								if (mousePressPrevious.inside(rect) && mousePressCurrent.inside(rect))
 								{
 									directRequestIndex = i;
-									dr.at<double>(i) = Ueva::screen2ctrl(mousePressDisplacement,
+									dr[i] = Ueva::screen2ctrl(mousePressDisplacement,
 										channels[activatedChannelIndices[i]].direction, micronPerPixel);
 									break;
 								}
@@ -779,18 +1002,21 @@ void S2EngineThread::run()
 								{
 									if (settings.inverseLinkRequests[activatedChannelIndices[i]])
 									{
-										dr.at<double>(i) = -dr.at<double>(directRequestIndex);
+										dr[i] = -dr[directRequestIndex];
 									}
 									else
 									{
-										dr.at<double>(i) = dr.at<double>(directRequestIndex);
+										dr[i] = dr[directRequestIndex];
 									}
 								}
 							}
 						}
 
 						// reference
-						r += dr;
+						for (int i = 0; i < p; i++)
+						{
+							r[i] += dr[i];
+						}
 
 						// measurment
 						for (int i = 0; i < activatedChannelIndices.size(); i++)
@@ -799,7 +1025,7 @@ void S2EngineThread::run()
 							if (channels[activatedChannelIndices[i]].measuringMarkerIndex != -1 &&
 								channels[activatedChannelIndices[i]].neckDropletIndex == -1)
 							{
-								y.at<double>(i) = Ueva::screen2ctrl(
+								y[i] = Ueva::screen2ctrl(
 									newMarkers[channels[activatedChannelIndices[i]].measuringMarkerIndex].centroid,
 									channels[activatedChannelIndices[i]].direction,
 									micronPerPixel);
@@ -812,35 +1038,36 @@ void S2EngineThread::run()
 								{
 									if (settings.neckDirectionRequests[activatedChannelIndices[i]])
 									{
-										y.at<double>(i) = y_raw.at<double>(i) + dr.at<double>(directRequestIndex);
+										y[i] = y_raw[i] + dr[directRequestIndex];
 									}
 									else
 									{
-										y.at<double>(i) = y_raw.at<double>(i) - dr.at<double>(directRequestIndex);
+										y[i] = y_raw[i] - dr[directRequestIndex];
 									}
 								}
 								else
 								{
-									double value = y_raw.at<double>(i); // get around weird behavior of cv::Mat::at
-									y.at<double>(i) = value; 
+									y[i] = y_raw[i];
 								}
 							}
 						}
 						// update offset
 						if (needSelecting || needReleasing)
-						{								
-							y_off += y - y_raw;
+						{
+							for (int i = 0; i < p; i++)
+							{
+								y_off[i] += y[i] - y_raw[i];
+							}
 						}
 						// save raw output
-						y_raw = y.clone();
+						y_raw = y;
 						// modify output with neck
 						for (int i = 0; i < activatedChannelIndices.size(); i++)
 						{
 							if (channels[activatedChannelIndices[i]].measuringMarkerIndex == -1 &&
 								channels[activatedChannelIndices[i]].neckDropletIndex != -1)
 							{
-								double value = y.at<double>(i); // get around weird behavior of cv::Mat::at
-								y.at<double>(i) = value + Ueva::neck2ctrl(
+								y[i] += Ueva::neck2ctrl(
 									droplets[channels[activatedChannelIndices[i]].neckDropletIndex].neckDistance,
 									micronPerPixel,
 									settings.ctrlNeckDesire,
@@ -850,52 +1077,38 @@ void S2EngineThread::run()
 							}
 						}
 						// output = (raw and modified) - offset
-						y -= y_off;	
-
-						// kalman filter
-						pp = ctrl.Ad * pe * ctrl.Ad.t() + ctrl.Wd * rw * ctrl.Wd.t();
-						cv::Mat mat = ctrl.Cd * pp * ctrl.Cd.t() + rv;
-						k = pp * ctrl.Cd.t() * mat.inv();
-						cv::Mat eyeNplusM = cv::Mat::eye(ctrl.n + ctrl.m, ctrl.n + ctrl.m, CV_64FC1);
-						pe = (eyeNplusM - k * ctrl.Cd) * pp;
-						xp = ctrl.Ad * xe + ctrl.Bd * u;
-						yk = ctrl.Cd * xp;
-						xe = xp + k * (y - yk);
-
-						// luenburger
-						yl = ctrl.C * xl + ctrl.D * u;
-						xl = ctrl.A * xl + ctrl.B * u + ctrl.H * (y - yl);
-
-						// integral state feed back
-						z += UevaCtrl::samplePeriod * (y - r);
-						u = -ctrl.K1 * xl - ctrl.K2 * z;
+						for (int i = 0; i < p; i++)
+						{
+							y[i] -= y_off[i];
+						}
+
+						// kalman filter, luenburger, integral state feed back
+						ctrlKernel.step();
 
 						// carry forward
-						
-						for (int i = 0; i < ctrl.p; i++)
+						for (int i = 0; i < p; i++)
 						{
-							uchar outputIndex = ctrl.outputIndices.at<uchar>(i);
-							reference[outputIndex] = r.at<double>(i);
-							output[outputIndex] = y.at<double>(i);
-							outputLuenburger[outputIndex] = yl.at<double>(i);
-							outputRaw[outputIndex] = y_raw.at<double>(i);
-							outputOffset[outputIndex] = y_off.at<double>(i);
-							outputKalman[outputIndex] = yk.at<double>(i);
-							stateIntegral[outputIndex] = z.at<double>(i);
+							int outputIndex = ctrlKernel.outputIndices[i];
+							reference[outputIndex] = r[i];
+							output[outputIndex] = y[i];
+							outputLuenburger[outputIndex] = ctrlKernel.yl[i];
+							outputRaw[outputIndex] = y_raw[i];
+							outputOffset[outputIndex] = y_off[i];
+							outputKalman[outputIndex] = ctrlKernel.yk[i];
+							stateIntegral[outputIndex] = ctrlKernel.z[i];
 						}
-						for (int i = 0; i < ctrl.n; i++)
+						for (int i = 0; i < n; i++)
 						{
-							uchar stateIndex = ctrl.stateIndices.at<uchar>(i);
-							stateLuenburger[stateIndex] = xl.at<double>(i);
-							stateKalman[stateIndex] = xe.at<double>(i);
+							int stateIndex = ctrlKernel.stateIndices[i];
+							stateLuenburger[stateIndex] = ctrlKernel.xl[i];
+							stateKalman[stateIndex] = ctrlKernel.xe[i];
 						}
-						for (int i = 0; i < ctrl.m; i++)
+						for (int i = 0; i < m; i++)
 						{
-							command[i] = u.at<double>(i);
-							disturbance[i] = xe.at<double>(ctrl.n + i);
+							command[i] = ctrlKernel.u[i];
+							disturbance[i] = ctrlKernel.xe[n + i];
 							correction[i] += settings.ctrlDisturbanceCorr * disturbance[i];
 						}
-						//posteriorErrorCov = pe.clone(); redundant
 
 						// clean up
 						needSelecting = false;
@@ -919,10 +1132,12 @@ void S2EngineThread::run()
 					data.map["ctrlStateLuenburger"] = stateLuenburger;
 					data.map["ctrlStateIntegral"] = stateIntegral;
 					data.map["ctrlcommand"] = command;
+					profiler.end(UevaProfiler::KALMAN);
 				}
 				//// DRAW
 				if (!data.rawGray.empty())
 				{
+					profiler.begin(UevaProfiler::DRAW);
 					cv::cvtColor(data.rawGray, data.drawnBgr, CV_GRAY2BGR);
 					// draw channel contour
 					if (settings.flag & UevaSettings::DRAW_CHANNEL)
@@ -942,14 +1157,17 @@ void S2EngineThread::run()
 						cv::drawContours(data.drawnBgr, dropletContours, -1,
 							lineColor, lineThickness, lineType);
 					}
-					// draw marker contour
+					// draw marker blob
 					if (settings.flag & UevaSettings::DRAW_MARKER)
 					{
 						lineColor = cv::Scalar(255, 255, 0); // cyan
 						lineThickness = 1;
 						lineType = 8;
-						cv::drawContours(data.drawnBgr, markerContours, -1,
-							lineColor, lineThickness, lineType);
+						for (int i = 0; i < newMarkers.size(); i++)
+						{
+							cv::rectangle(data.drawnBgr, newMarkers[i].blob,
+								lineColor, lineThickness, lineType);
+						}
 					}
 					// draw kink and neck
 					if (settings.flag & UevaSettings::DRAW_NECK)
@@ -1011,14 +1229,18 @@ void S2EngineThread::run()
 					
 					cv::cvtColor(data.drawnBgr, data.drawnRgb, CV_BGR2RGB);
 					cv::resize(data.drawnRgb, data.drawnRgb, cv::Size(), settings.displayScale, settings.displayScale, 1);
+					profiler.end(UevaProfiler::DRAW);
 				}
 			}
 
+			profiler.begin(UevaProfiler::EMIT);
 			emit engineSignal(data);
+			profiler.end(UevaProfiler::EMIT);
 			idle = true;
-			//QTime exit = QTime::currentTime();
-			//int ms = entrance.msecsTo(exit);
-			//qDebug() << "engine used (ms)" << ms;
+			publishContext();
+			profileMutex.lock();
+			profiler.endCycle();
+			profileMutex.unlock();
 			mutex.unlock();
 		}
 	}
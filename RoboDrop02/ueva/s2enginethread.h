@@ -36,6 +36,9 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 
 #include "uevastructures.h"
 #include "uevafunctions.h"
+#include "segmentthread.h"
+#include "uevaprofiler.h"
+#include "uevactrlkernel.h"
 
 class S2EngineThread : public QThread
 {
@@ -49,12 +52,19 @@ public:
 	void setSettings(const UevaSettings &s);
 	void setData(const UevaData &d);
 	void wake();
+	bool pushFrame(const UevaSettings &s, const UevaData &d);
+
+	//// PROFILE
+	QString getProfile();
+	bool dumpProfile(const std::string &fileName);
 
 	//// SINGLE TIME FUNCTION
 	void setCalib(double micronLength);
 	void setBkgd();
 	void separateChannels(int &numChan);
 	void sortChannels(std::map<std::string, std::vector<int> > &channelInfo);
+	bool channelBounds(cv::Rect_<int> &bounds); // union of channel rects plus margin, false without channels
+	void cropToAoi(const cv::Rect_<int> &aoi); // camera now reads out only aoi of old image
 	void loadCtrl(std::string fileName,
 		int *numState, int *numIn, int *numOut, int *numCtrl, double *ctrlTs);
 	void initImgproc();
@@ -70,21 +80,38 @@ protected:
 	void run();
 
 private:
+	//// PIPELINE
+	void publishContext();
+
+	//// CTRL
+	bool combinationPossible(std::vector<int> &combination, const int outerStage); // design time goes to its own stage
+	void releaseChannel(const int channelIndex, const int outerStage);
+
 	//// THREAD VARIABLES
 	bool idle;
 	QMutex mutex;
 	UevaSettings settings;
 	UevaData data;
+	SegmentThread segmenter;
+	UevaFrame segmented;
+	qint64 frameSequence; // gui thread only
+	qint64 lastSequence;
+	qint64 skippedResults;
+	UevaProfiler profiler;
+	QMutex profileMutex;
 
 	//// MULTI CYCLE VARIABLES
 	double micronPerPixel;
 	cv::Mat bkgd;
 	std::vector<UevaCtrl> ctrls;
+	UevaCtrlLookup ctrlLookup; // controller by active channel bit mask
+	UevaCtrlCache ctrlCache; // controllers designed from plant, after the loaded ones in ctrls
 	cv::Mat dropletMask;
 	cv::Mat markerMask;
 	cv::Mat allChannels;
 	std::vector<std::vector<cv::Point_<int>>> channelContours;
 	std::vector<UevaChannel> channels;
+	cv::Mat channelMap;
 	bool needSelecting;
 	bool needReleasing;
 
@@ -92,14 +119,11 @@ private:
 	std::vector<UevaMarker> oldMarkers;
 	std::vector<UevaMarker> newMarkers;
 	std::vector<int> activatedChannelIndices;
+	int windowedCycles; // since last full frame
 
 	QVector<qreal> ground;
 	QVector<qreal> correction;
-	cv::Mat posteriorErrorCov;
-	cv::Mat modelNoiseCov;
-	cv::Mat disturbanceNoiseCov;
-	cv::Mat processNoiseCov;
-	cv::Mat sensorNoiseCov;
+	UevaCtrlKernel ctrlKernel; // selected controller, its covariance and signal buffers
 	QVector<qreal> reference;
 	QVector<qreal> output;
 	QVector<qreal> outputLuenburger;
@@ -115,11 +139,18 @@ private:
 	//// SINGLE CYCLE VARIABLES
 	cv::Mat allDroplets; 
 	std::vector<std::vector< cv::Point_<int> >> dropletContours;
+	cv::Mat dropletLabels;
 	cv::Mat allMarkers;
-	std::vector<std::vector< cv::Point_<int> >> markerContours;
+	std::vector<UevaTile> tiles;
+	std::vector<int> followIndices;
+	cv::Mat windowEdges;
+	cv::Mat windowMarkers;
+	UevaBlobScratch windowBlobs;
+	std::vector<UevaMarker> windowCandidates;
 	
 	std::vector<int> desiredChannelIndices;
 	std::vector<UevaDroplet> droplets;
+	std::vector<UevaShapeScratch> shapeScratches;
 
 	cv::Point_<int> mousePressLeft;
 	cv::Point_<int> mousePressRight;
@@ -129,32 +160,19 @@ private:
 
 	int directRequestIndex;
 
-	cv::Mat k;
-	cv::Mat pp;
-	cv::Mat pe;
-	cv::Mat rw;
-	cv::Mat rv;
-	cv::Mat r;
-	cv::Mat dr;
-	cv::Mat y;
-	cv::Mat yl;
-	cv::Mat y_raw;
-	cv::Mat y_off;
-	cv::Mat yk;
-	cv::Mat xp;
-	cv::Mat xe;
-	cv::Mat xl;
-	cv::Mat z;
-	cv::Mat u;
-
 	//// CONVENIENCE VARIABLES
 	enum EngineConstants
 	{
 		LOW_VALUE = 0,
 		MID_VALUE = 127,
 		HIGH_VALUE = 255,
+		TILE_HALO = 32, // pixels around channel rect, channel tiles must not overlap
+		WINDOW_FULL_PERIOD = 30, // windowed cycles between full frames, catches new markers and droplets
+		CTRL_CACHE_SIZE = 64, // designed controllers kept
+		AOI_MARGIN = 16, // pixels kept around channels when fitting camera aoi
 	};
-	cv::Mat structuringElement;
+	std::vector<uchar> maskLevels;
+	std::vector<UevaBitImage> maskPlanes;
 	cv::Point_<int> seed;
 	int floodFillReturn;
 	cv::Scalar_<int> lineColor;
@@ -165,7 +183,6 @@ private:
 	cv::Moments mom;
 	cv::Rect rect;
 	std::string str;
-	bool alwaysTrue;
 
 	private slots:
 };
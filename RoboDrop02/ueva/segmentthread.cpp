@@ -0,0 +1,269 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "segmentthread.h"
+
+SegmentThread::SegmentThread(QObject *parent)
+	: QThread(parent), frames(FRAME_CAPACITY), results(RESULT_CAPACITY)
+{
+	stopping = false;
+	droppedFrames = 0;
+	halo = 0;
+	bkgdFresh = false;
+	bkgdUpdating = false;
+	bkgdQueued = false;
+	learnRate = 0.0f;
+	learnNs = 0;
+	learnTimer.start();
+}
+
+SegmentThread::~SegmentThread()
+{
+	stop();
+	wait();
+}
+
+
+
+//// THREAD OPERATIONS
+void SegmentThread::setContext(const cv::Mat &b, const cv::Mat &mm, const cv::Mat &dm,
+	const std::vector<UevaChannel> &c, const int h)
+{
+	// header copies, engine reallocates instead of overwriting anything still shared here
+	contextMutex.lock();
+	bkgd = b;
+	markerMask = mm;
+	dropletMask = dm;
+	channels = c;
+	halo = h;
+	contextMutex.unlock();
+}
+
+bool SegmentThread::hasContext()
+{
+	contextMutex.lock();
+	bool ready = !bkgd.empty() && !markerMask.empty() && !dropletMask.empty() && !channels.empty();
+	contextMutex.unlock();
+	return ready;
+}
+
+bool SegmentThread::pushFrame(const UevaFrame &frame)
+{
+	// segmentation slower than camera, skip frame rather than queue up latency
+	if (!frames.push(frame))
+	{
+		droppedFrames++;
+		return false;
+	}
+	pending.release();
+	return true;
+}
+
+int SegmentThread::popNewest(UevaFrame &frame)
+{
+	int num = results.popNewest(frame);
+	// one permit is enough to retry a push, keep them from piling up
+	if (num && !drained.available())
+	{
+		drained.release();
+	}
+	return num;
+}
+
+void SegmentThread::stop()
+{
+	stopping = true;
+	pending.release();
+	drained.release();
+}
+
+void SegmentThread::resetBkgd(const cv::Mat &b, const std::vector<UevaChannel> &c)
+{
+	bkgdMutex.lock();
+	while (bkgdUpdating)
+	{
+		bkgdIdle.wait(&bkgdMutex);
+	}
+	Ueva::resetBkgdModel(bkgdModel, b, c);
+	bkgdFresh = false;
+	bkgdQueued = false;
+	learnRaw.release();
+	bkgdMutex.unlock();
+}
+
+bool SegmentThread::takeBkgd(cv::Mat &b, qint64 &ns)
+{
+	bkgdMutex.lock();
+	bool taken = bkgdFresh;
+	if (taken)
+	{
+		b = bkgdModel.front;
+		ns = learnNs;
+		bkgdFresh = false;
+	}
+	bkgdMutex.unlock();
+	if (taken)
+	{
+		// context must not keep a buffer that is about to be written
+		contextMutex.lock();
+		bkgd = b;
+		contextMutex.unlock();
+	}
+	return taken;
+}
+
+bool SegmentThread::learnBkgd(const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers,
+	const float rate)
+{
+	// engine reuses its masks next cycle, so region is copied into buffers only this thread reads
+	bkgdMutex.lock();
+	bool accepted = !bkgdQueued && !bkgdUpdating && !bkgdFresh &&
+		!bkgdModel.front.empty() && bkgdModel.front.size() == rawGray.size();
+	if (accepted)
+	{
+		const cv::Rect_<int> &region = bkgdModel.region;
+		learnRaw = rawGray;
+		learnDroplets.create(rawGray.size(), CV_8UC1);
+		learnMarkers.create(rawGray.size(), CV_8UC1);
+		allDroplets(region).copyTo(learnDroplets(region));
+		allMarkers(region).copyTo(learnMarkers(region));
+		learnRate = rate;
+		bkgdQueued = true;
+	}
+	bkgdMutex.unlock();
+	if (accepted)
+	{
+		pending.release();
+	}
+	return accepted;
+}
+
+void SegmentThread::updateBkgd(const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers,
+	const float rate)
+{
+	// back is only written once engine holds front, the one this thread segments with
+	bkgdMutex.lock();
+	if (bkgdFresh || bkgdModel.front.empty() || bkgdModel.front.size() != rawGray.size())
+	{
+		bkgdMutex.unlock();
+		return;
+	}
+	bkgdUpdating = true;
+	bkgdMutex.unlock();
+
+	qint64 start = learnTimer.nsecsElapsed();
+	Ueva::updateBkgdModel(bkgdModel, rawGray, allDroplets, allMarkers, rate);
+	qint64 ns = learnTimer.nsecsElapsed() - start;
+
+	// finished background becomes front, old front is written next time
+	bkgdMutex.lock();
+	cv::swap(bkgdModel.front, bkgdModel.back);
+	learnNs = ns;
+	bkgdFresh = true;
+	bkgdUpdating = false;
+	bkgdIdle.wakeAll();
+	bkgdMutex.unlock();
+}
+
+
+
+//// CONTINUOUS
+void SegmentThread::run()
+{
+	UevaFrame frame;
+	cv::Mat b;
+	cv::Mat mm;
+	cv::Mat dm;
+	std::vector<UevaChannel> c;
+	int h;
+	while (!stopping)
+	{
+		// sleep until a frame or learn job arrives
+		pending.acquire();
+		if (stopping)
+		{
+			break;
+		}
+		if (!frames.pop(frame))
+		{
+			// no frame to segment, learn background engine handed over
+			bkgdMutex.lock();
+			bool queued = bkgdQueued;
+			bkgdMutex.unlock();
+			if (queued)
+			{
+				updateBkgd(learnRaw, learnDroplets, learnMarkers, learnRate);
+				bkgdMutex.lock();
+				bkgdQueued = false;
+				learnRaw.release();
+				bkgdMutex.unlock();
+			}
+			continue;
+		}
+
+		// snapshot context so engine is free to swap in new masks or background
+		bool adaptive = (frame.settings.flag & UevaSettings::BKGD_ADAPTIVE) != 0;
+		contextMutex.lock();
+		b = bkgd;
+		mm = markerMask;
+		dm = dropletMask;
+		c = channels;
+		h = halo;
+		contextMutex.unlock();
+		if (adaptive)
+		{
+			// newest learnt background, only this thread ever writes it
+			bkgdMutex.lock();
+			if (!bkgdModel.front.empty())
+			{
+				b = bkgdModel.front;
+			}
+			bkgdMutex.unlock();
+		}
+		if (b.empty() || mm.empty() || dm.empty() || c.empty() ||
+			b.size() != frame.data.rawGray.size())
+		{
+			continue;
+		}
+
+		Ueva::makeTiles(c, frame.data.rawGray.size(), h,
+			(frame.settings.flag & UevaSettings::IMGPROC_TILED) != 0, tiles);
+		Ueva::segmentTiles(frame.data.rawGray, b, mm, dm, frame.settings, tiles);
+		Ueva::mergeTiles(tiles, frame.data.rawGray.size(),
+			frame.allMarkers, frame.allDroplets, frame.markers, frame.dropletContours);
+		Ueva::tileStageTimes(tiles, frame.stageNs);
+
+		// learn from this frame while engine works on previous one
+		if (adaptive)
+		{
+			updateBkgd(frame.data.rawGray, frame.allDroplets, frame.allMarkers, frame.settings.bkgdRate);
+		}
+
+		// engine always drains to newest, so a full queue only lasts one engine cycle
+		while (!results.push(frame))
+		{
+			drained.acquire();
+			if (stopping)
+			{
+				return;
+			}
+		}
+		frame = UevaFrame();
+	}
+}
@@ -0,0 +1,107 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef SEGMENTTHREAD_H
+#define SEGMENTTHREAD_H
+
+#include <atomic>
+#include <QtGui >
+#include <QThread >
+#include <QMutex >
+#include <QWaitCondition >
+#include <QSemaphore >
+#include <QElapsedTimer >
+#include "opencv2/core.hpp"
+
+#include "uevastructures.h"
+#include "uevafunctions.h"
+#include "uevaspscqueue.h"
+
+// first pipeline stage, segments frame N+1 while engine controls and draws frame N
+// frames come from gui thread, results go to engine thread, one producer and one consumer per queue
+class SegmentThread : public QThread
+{
+public:
+	SegmentThread(QObject *parent = 0);
+	~SegmentThread();
+
+	//// THREAD OPERATIONS
+	void setContext(const cv::Mat &bkgd, const cv::Mat &markerMask, const cv::Mat &dropletMask,
+		const std::vector<UevaChannel> &channels, const int halo);
+	bool hasContext();
+	bool pushFrame(const UevaFrame &frame); // gui thread
+	int popNewest(UevaFrame &frame); // engine thread
+	void stop();
+
+	//// ADAPTIVE BACKGROUND
+	// learnt on this thread so control cycle never pays for it, engine hands over full frames when not pipelined
+	void resetBkgd(const cv::Mat &bkgd, const std::vector<UevaChannel> &channels); // engine thread
+	bool takeBkgd(cv::Mat &bkgd, qint64 &learnNs); // engine thread, false when nothing newer was learnt
+	bool learnBkgd(const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers,
+		const float rate); // engine thread, false when still busy with previous one
+
+	qint64 droppedFrames; // written by gui thread only
+
+protected:
+	//// CONTINUOUS FUNCTION
+	void run();
+
+private:
+	enum QueueConstants
+	{
+		FRAME_CAPACITY = 2,
+		RESULT_CAPACITY = 2,
+	};
+
+	//// THREAD VARIABLES
+	QMutex contextMutex; // only guards context, never held while segmenting
+	std::atomic<bool> stopping;
+	UevaSpscQueue<UevaFrame> frames;
+	UevaSpscQueue<UevaFrame> results;
+	QSemaphore pending; // one per queued frame or learn job, thread sleeps on it instead of polling
+	QSemaphore drained; // engine popped results, wakes thread waiting on a full result queue
+
+	//// CONTEXT FROM ENGINE
+	cv::Mat bkgd;
+	cv::Mat markerMask;
+	cv::Mat dropletMask;
+	std::vector<UevaChannel> channels;
+	int halo;
+
+	//// CYCLE VARIABLES
+	std::vector<UevaTile> tiles;
+
+	//// BACKGROUND VARIABLES
+	void updateBkgd(const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers, const float rate);
+	QMutex bkgdMutex; // guards flags and buffer headers, never held while learning
+	QWaitCondition bkgdIdle;
+	UevaBkgdModel bkgdModel; // learnt by this thread only, reset by engine while idle
+	bool bkgdFresh; // front learnt since engine last took it, back is then still the engine's
+	bool bkgdUpdating;
+	bool bkgdQueued; // engine handed over a frame to learn
+	cv::Mat learnRaw;
+	cv::Mat learnDroplets; // full frame, only region copied
+	cv::Mat learnMarkers;
+	float learnRate;
+	qint64 learnNs; // time spent learning front
+	QElapsedTimer learnTimer;
+};
+
+#endif // SEGMENTTHREAD_H
@@ -0,0 +1,91 @@
+# minimal qmake build of ueva, same sources as ueva.vcxproj
+# default has no andor sdk, replay is then the only camera: qmake && make (or nmake / jom)
+# live zyla: qmake CONFIG+=andor, sdk expected in ANDOR_DIR
+# opencv 3.1 in OPENCV_DIR; windows only, pumps go through mfcs_c_64.dll
+
+TEMPLATE = app
+TARGET = ueva
+QT += core gui widgets
+CONFIG += c++11 console
+
+SOURCES += \
+	main.cpp \
+	mainwindow.cpp \
+	addpumpdialog.cpp \
+	camerathread.cpp \
+	channelinfowidget.cpp \
+	dashboard.cpp \
+	display.cpp \
+	inletwidget.cpp \
+	mfcs.cpp \
+	plot.cpp \
+	plotter.cpp \
+	pumpthread.cpp \
+	setup.cpp \
+	s2enginethread.cpp \
+	segmentthread.cpp \
+	uevabitimage.cpp \
+	uevactrldesign.cpp \
+	uevactrlkernel.cpp \
+	uevaframepool.cpp \
+	uevaframesource.cpp \
+	uevafunctions.cpp \
+	uevaprofiler.cpp \
+	uevareplaysource.cpp \
+	uevastructures.cpp \
+	uevaunpack.cpp \
+	zyla.cpp
+
+HEADERS += \
+	mainwindow.h \
+	addpumpdialog.h \
+	camerathread.h \
+	channelinfowidget.h \
+	dashboard.h \
+	display.h \
+	inletwidget.h \
+	mfcs.h \
+	plot.h \
+	plotter.h \
+	pumpthread.h \
+	setup.h \
+	s2enginethread.h \
+	segmentthread.h \
+	uevabitimage.h \
+	uevactrldesign.h \
+	uevactrlkernel.h \
+	uevaframepool.h \
+	uevaframesource.h \
+	uevafunctions.h \
+	uevaprofiler.h \
+	uevareplaysource.h \
+	uevaspscqueue.h \
+	uevastructures.h \
+	uevaunpack.h \
+	zyla.h \
+	persistence1d.hpp
+
+FORMS += \
+	addpumpdialog.ui \
+	channelinfowidget.ui \
+	dashboard.ui \
+	inletwidget.ui \
+	plotter.ui \
+	setup.ui
+
+RESOURCES += ueva.qrc
+RC_FILE = ueva.rc
+
+andor {
+	isEmpty(ANDOR_DIR): ANDOR_DIR = "C:/Program Files/Andor SDK3"
+	INCLUDEPATH += $$ANDOR_DIR
+	LIBS += -L$$ANDOR_DIR -latcorem -latmcd64m -latutilitym
+} else {
+	DEFINES += UEVA_NO_ANDOR
+}
+
+isEmpty(OPENCV_DIR): OPENCV_DIR = C:/opencv/build
+INCLUDEPATH += $$OPENCV_DIR/include
+LIBS += -L$$OPENCV_DIR/x64/vc12/lib
+CONFIG(debug, debug|release): LIBS += -lopencv_world310d
+else: LIBS += -lopencv_world310
@@ -0,0 +1,413 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "uevabitimage.h"
+
+
+
+//// HELPERS
+static const uint64 ALL_ONES = ~(uint64)0;
+
+// 64 bits starting at bit position p of a row, bits past either end read as fill
+static inline uint64 bitsAt(const uint64 *row, const int numWords, const int p, const uint64 fill)
+{
+	int q = p >> 6;
+	int r = p & 63;
+	uint64 lo = (q >= 0 && q < numWords) ? row[q] : fill;
+	if (r == 0)
+	{
+		return lo;
+	}
+	uint64 hi = (q + 1 >= 0 && q + 1 < numWords) ? row[q + 1] : fill;
+	return (lo >> r) | (hi << (64 - r));
+}
+
+static inline uint64 combine(const uint64 a, const uint64 b, const bool isErode)
+{
+	return isErode ? (a & b) : (a | b);
+}
+
+static inline int popcount64(uint64 v)
+{
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+}
+
+// 16 bits to 16 bytes of 0xFF or 0x00
+static inline __m128i expand16(const int bits)
+{
+	const __m128i pattern = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	__m128i v = _mm_unpacklo_epi64(_mm_set1_epi8((char)(bits & 0xFF)), _mm_set1_epi8((char)(bits >> 8)));
+	return _mm_cmpeq_epi8(_mm_and_si128(v, pattern), pattern);
+}
+
+
+
+//// BIT IMAGE
+UevaBitImage::UevaBitImage()
+{
+	rows = 0;
+	cols = 0;
+	wordsPerRow = 0;
+}
+
+UevaBitImage::UevaBitImage(const int rows, const int cols)
+{
+	create(rows, cols);
+}
+
+void UevaBitImage::create(const int r, const int c)
+{
+	rows = r;
+	cols = c;
+	wordsPerRow = (c + 63) / 64;
+	words.resize((size_t)rows * wordsPerRow);
+}
+
+bool UevaBitImage::empty() const
+{
+	return words.empty();
+}
+
+uint64 *UevaBitImage::ptr(const int y)
+{
+	return &words[(size_t)y * wordsPerRow];
+}
+
+const uint64 *UevaBitImage::ptr(const int y) const
+{
+	return &words[(size_t)y * wordsPerRow];
+}
+
+uint64 UevaBitImage::lastWordMask() const
+{
+	int r = cols & 63;
+	return r ? ((uint64)1 << r) - 1 : ALL_ONES;
+}
+
+void UevaBitImage::fromMat(const cv::Mat &mat, const uchar level)
+{
+	CV_Assert(mat.type() == CV_8UC1);
+	create(mat.rows, mat.cols);
+	if (level == 0)
+	{
+		setTo(true);
+		return;
+	}
+	const __m128i vLevel = _mm_set1_epi8((char)level);
+	for (int y = 0; y < rows; y++)
+	{
+		const uchar *m = mat.ptr<uchar>(y);
+		uint64 *b = ptr(y);
+		int x = 0;
+		// unsigned m >= level is max(m, level) == m
+		for (; x <= cols - 64; x += 64)
+		{
+			uint64 word = 0;
+			for (int k = 0; k < 4; k++)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(m + x + 16 * k));
+				int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, vLevel), v));
+				word |= (uint64)(unsigned)bits << (16 * k);
+			}
+			b[x >> 6] = word;
+		}
+		if (x < cols)
+		{
+			uint64 word = 0;
+			for (int i = 0; x + i < cols; i++)
+			{
+				if (m[x + i] >= level)
+				{
+					word |= (uint64)1 << i;
+				}
+			}
+			b[x >> 6] = word;
+		}
+	}
+}
+
+void UevaBitImage::toMat(cv::Mat &mat, const uchar value) const
+{
+	mat.create(rows, cols, CV_8UC1);
+	const __m128i vValue = _mm_set1_epi8((char)value);
+	for (int y = 0; y < rows; y++)
+	{
+		const uint64 *b = ptr(y);
+		uchar *m = mat.ptr<uchar>(y);
+		int x = 0;
+		for (; x <= cols - 16; x += 16)
+		{
+			int bits = (int)((b[x >> 6] >> (x & 63)) & 0xFFFF);
+			_mm_storeu_si128((__m128i*)(m + x), _mm_and_si128(expand16(bits), vValue));
+		}
+		for (; x < cols; x++)
+		{
+			m[x] = ((b[x >> 6] >> (x & 63)) & 1) ? value : 0;
+		}
+	}
+}
+
+void UevaBitImage::paintMat(cv::Mat &mat, const uchar value) const
+{
+	CV_Assert(mat.type() == CV_8UC1 && mat.rows == rows && mat.cols == cols);
+	const __m128i vValue = _mm_set1_epi8((char)value);
+	for (int y = 0; y < rows; y++)
+	{
+		const uint64 *b = ptr(y);
+		uchar *m = mat.ptr<uchar>(y);
+		int x = 0;
+		for (; x <= cols - 16; x += 16)
+		{
+			int bits = (int)((b[x >> 6] >> (x & 63)) & 0xFFFF);
+			if (bits)
+			{
+				__m128i set = expand16(bits);
+				__m128i old = _mm_loadu_si128((const __m128i*)(m + x));
+				_mm_storeu_si128((__m128i*)(m + x), _mm_or_si128(_mm_and_si128(set, vValue), _mm_andnot_si128(set, old)));
+			}
+		}
+		for (; x < cols; x++)
+		{
+			if ((b[x >> 6] >> (x & 63)) & 1)
+			{
+				m[x] = value;
+			}
+		}
+	}
+}
+
+void UevaBitImage::setTo(const bool value)
+{
+	std::fill(words.begin(), words.end(), value ? ALL_ONES : 0);
+	if (value && wordsPerRow)
+	{
+		uint64 mask = lastWordMask();
+		for (int y = 0; y < rows; y++)
+		{
+			ptr(y)[wordsPerRow - 1] &= mask;
+		}
+	}
+}
+
+void UevaBitImage::andWith(const UevaBitImage &other)
+{
+	CV_Assert(rows == other.rows && cols == other.cols);
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		words[i] &= other.words[i];
+	}
+}
+
+void UevaBitImage::orWith(const UevaBitImage &other)
+{
+	CV_Assert(rows == other.rows && cols == other.cols);
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		words[i] |= other.words[i];
+	}
+}
+
+void UevaBitImage::invert()
+{
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		words[i] = ~words[i];
+	}
+	if (wordsPerRow)
+	{
+		uint64 mask = lastWordMask();
+		for (int y = 0; y < rows; y++)
+		{
+			ptr(y)[wordsPerRow - 1] &= mask;
+		}
+	}
+}
+
+int UevaBitImage::popcount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		count += popcount64(words[i]);
+	}
+	return count;
+}
+
+void UevaBitImage::erode(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel)
+{
+	morph(src, dst, kernel, true);
+}
+
+void UevaBitImage::dilate(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel)
+{
+	morph(src, dst, kernel, false);
+}
+
+void UevaBitImage::morph(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel, const bool isErode)
+{
+	CV_Assert(kernel.width > 0 && kernel.height > 0);
+	if (src.empty())
+	{
+		dst.create(src.rows, src.cols);
+		return;
+	}
+	const int rows = src.rows;
+	const int wpr = src.wordsPerRow;
+	const int kw = kernel.width;
+	const int kh = kernel.height;
+	const int ax = kw / 2; // opencv default anchor
+	const int ay = kh / 2;
+	// outside pixels never change result, like opencv default border
+	const uint64 fill = isErode ? ALL_ONES : 0;
+	const uint64 lastMask = src.lastWordMask();
+
+	//// HORIZONTAL: window of kw bits by doubling shifts, log(kw) passes per row
+	const int pad = kw / 64 + 2;
+	const int bufWords = wpr + 2 * pad;
+	dst.rowBuffer.resize(bufWords);
+	dst.horizontal.resize((size_t)rows * wpr);
+	uint64 *buf = dst.rowBuffer.empty() ? 0 : &dst.rowBuffer[0];
+	for (int y = 0; y < rows; y++)
+	{
+		const uint64 *s = src.ptr(y);
+		for (int w = 0; w < pad; w++)
+		{
+			buf[w] = fill;
+			buf[pad + wpr + w] = fill;
+		}
+		for (int w = 0; w < wpr; w++)
+		{
+			buf[pad + w] = s[w];
+		}
+		buf[pad + wpr - 1] = (buf[pad + wpr - 1] & lastMask) | (fill & ~lastMask);
+
+		// buf bit x becomes op over bits x .. x+len-1, reading only higher words so in place is safe
+		int len = 1;
+		while (2 * len <= kw)
+		{
+			for (int w = 0; w < bufWords; w++)
+			{
+				buf[w] = combine(buf[w], bitsAt(buf, bufWords, 64 * w + len, fill), isErode);
+			}
+			len *= 2;
+		}
+		// two overlapping windows of len cover kw, shifted back by anchor
+		uint64 *h = &dst.horizontal[(size_t)y * wpr];
+		for (int w = 0; w < wpr; w++)
+		{
+			int p = 64 * (pad + w) - ax;
+			h[w] = combine(bitsAt(buf, bufWords, p, fill), bitsAt(buf, bufWords, p + kw - len, fill), isErode);
+		}
+	}
+
+	//// VERTICAL: rows y-ay .. y-ay+kh-1 of horizontal result
+	dst.create(src.rows, src.cols);
+	const int numExtended = rows + kh - 1;
+	dst.rowBuffer.assign(wpr, fill);
+	const uint64 *fillRow = dst.rowBuffer.empty() ? 0 : &dst.rowBuffer[0];
+	const uint64 *horz = dst.horizontal.empty() ? 0 : &dst.horizontal[0];
+#define EXTENDED_ROW(i) (((i) - ay >= 0 && (i) - ay < rows) ? horz + (size_t)((i) - ay) * wpr : fillRow)
+	if (kh <= 4)
+	{
+		// few rows, direct
+		for (int y = 0; y < rows; y++)
+		{
+			uint64 *d = dst.ptr(y);
+			const uint64 *e = EXTENDED_ROW(y);
+			for (int w = 0; w < wpr; w++)
+			{
+				d[w] = e[w];
+			}
+			for (int i = 1; i < kh; i++)
+			{
+				e = EXTENDED_ROW(y + i);
+				for (int w = 0; w < wpr; w++)
+				{
+					d[w] = combine(d[w], e[w], isErode);
+				}
+			}
+		}
+	}
+	else
+	{
+		// van Herk / Gil-Werman, blocks of kh with prefix and suffix, 3 ops per pixel whatever the size
+		dst.prefix.resize((size_t)numExtended * wpr);
+		dst.suffix.resize((size_t)numExtended * wpr);
+		for (int i = 0; i < numExtended; i++)
+		{
+			const uint64 *e = EXTENDED_ROW(i);
+			uint64 *g = &dst.prefix[(size_t)i * wpr];
+			if (i % kh == 0)
+			{
+				for (int w = 0; w < wpr; w++)
+				{
+					g[w] = e[w];
+				}
+			}
+			else
+			{
+				const uint64 *gPrev = g - wpr;
+				for (int w = 0; w < wpr; w++)
+				{
+					g[w] = combine(gPrev[w], e[w], isErode);
+				}
+			}
+		}
+		for (int i = numExtended - 1; i >= 0; i--)
+		{
+			const uint64 *e = EXTENDED_ROW(i);
+			uint64 *h = &dst.suffix[(size_t)i * wpr];
+			if (i % kh == kh - 1 || i == numExtended - 1)
+			{
+				for (int w = 0; w < wpr; w++)
+				{
+					h[w] = e[w];
+				}
+			}
+			else
+			{
+				const uint64 *hNext = h + wpr;
+				for (int w = 0; w < wpr; w++)
+				{
+					h[w] = combine(e[w], hNext[w], isErode);
+				}
+			}
+		}
+		for (int y = 0; y < rows; y++)
+		{
+			const uint64 *h = &dst.suffix[(size_t)y * wpr];
+			const uint64 *g = &dst.prefix[(size_t)(y + kh - 1) * wpr];
+			uint64 *d = dst.ptr(y);
+			for (int w = 0; w < wpr; w++)
+			{
+				d[w] = combine(h[w], g[w], isErode);
+			}
+		}
+	}
+#undef EXTENDED_ROW
+
+	// keep bits past last column zero
+	for (int y = 0; y < rows && wpr; y++)
+	{
+		dst.ptr(y)[wpr - 1] &= lastMask;
+	}
+}
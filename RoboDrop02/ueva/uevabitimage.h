@@ -0,0 +1,71 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVABITIMAGE_H
+#define UEVABITIMAGE_H
+
+#include "opencv2/core.hpp"
+#include <vector>
+#include <cstring>
+#include <emmintrin.h>
+
+// binary image with 64 pixels per word, pixel x is bit x%64 of word x/64
+// bits past the last column are always zero
+struct UevaBitImage
+{
+	UevaBitImage();
+	UevaBitImage(const int rows, const int cols);
+
+	void create(const int rows, const int cols);
+	bool empty() const;
+	uint64 *ptr(const int y);
+	const uint64 *ptr(const int y) const;
+
+	void fromMat(const cv::Mat &mat, const uchar level = 1); // bit set where mat >= level
+	void toMat(cv::Mat &mat, const uchar value = 255) const; // value where set, 0 elsewhere
+	void paintMat(cv::Mat &mat, const uchar value) const; // value where set, others untouched
+
+	void setTo(const bool value);
+	void andWith(const UevaBitImage &other);
+	void orWith(const UevaBitImage &other);
+	void invert();
+	int popcount() const;
+
+	// rectangular structuring element with centre anchor, same result as cv::erode and cv::dilate
+	static void erode(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel);
+	static void dilate(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel);
+
+	int rows;
+	int cols;
+	int wordsPerRow;
+	std::vector<uint64> words;
+
+	// reused by morphology so repeated calls do not allocate
+	std::vector<uint64> rowBuffer;
+	std::vector<uint64> horizontal;
+	std::vector<uint64> prefix;
+	std::vector<uint64> suffix;
+
+private:
+	uint64 lastWordMask() const;
+	static void morph(const UevaBitImage &src, UevaBitImage &dst, const cv::Size_<int> &kernel, const bool isErode);
+};
+
+#endif // UEVABITIMAGE_H
@@ -0,0 +1,413 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "uevactrldesign.h"
+
+//// RICCATI
+
+bool Ueva::solveDare(const cv::Mat &a, const cv::Mat &b, const cv::Mat &q, const cv::Mat &r, cv::Mat &p)
+{
+	const int MAX_ITERATION = 100;
+	const double TOLERANCE = 1e-13;
+	const int n = a.rows;
+	CV_Assert(a.cols == n && b.rows == n && q.rows == n && q.cols == n);
+	CV_Assert(r.rows == b.cols && r.cols == b.cols);
+
+	// doubling of a, g = b inv(r) b' and h = q, h converges to p
+	cv::Mat rInvBt;
+	if (!cv::solve(r, b.t(), rInvBt, cv::DECOMP_LU))
+	{
+		return false;
+	}
+	cv::Mat ak = a.clone();
+	cv::Mat gk = b * rInvBt;
+	cv::Mat hk = q.clone();
+	cv::Mat eye = cv::Mat::eye(n, n, CV_64FC1);
+	cv::Mat ag, x, x1, x2, hn;
+	for (int iteration = 0; iteration < MAX_ITERATION; iteration++)
+	{
+		// x = inv(I + g h) [a g]
+		cv::hconcat(ak, gk, ag);
+		if (!cv::solve(eye + gk * hk, ag, x, cv::DECOMP_LU))
+		{
+			return false;
+		}
+		x1 = x.colRange(0, n);
+		x2 = x.colRange(n, 2 * n);
+		hn = hk + ak.t() * hk * x1;
+		gk = gk + ak * x2 * ak.t();
+		ak = ak * x1;
+		double change = cv::norm(hn, hk, cv::NORM_INF);
+		hn.copyTo(hk);
+		if (!cv::checkRange(hk))
+		{
+			return false;
+		}
+		if (change <= TOLERANCE * cv::norm(hk, cv::NORM_INF) &&
+			cv::norm(ak, cv::NORM_INF) <= std::sqrt(TOLERANCE)) // closed loop power vanished, stabilizing
+		{
+			p = 0.5 * (hk + hk.t());
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Ueva::dlqr(const cv::Mat &a, const cv::Mat &b, const cv::Mat &q, const cv::Mat &r, cv::Mat &k)
+{
+	cv::Mat p;
+	if (!solveDare(a, b, q, r, p))
+	{
+		return false;
+	}
+	cv::Mat btp = b.t() * p;
+	return cv::solve(r + btp * b, btp * a, k, cv::DECOMP_LU);
+}
+
+//// DESIGN
+
+bool Ueva::designCtrl(const UevaPlant &plant, const std::vector<int> &combination, UevaCtrl &ctrl)
+{
+	const int numState = plant.A.rows;
+	const int numOutput = plant.C.rows;
+	const int m = plant.B.cols;
+	const int p = (int)combination.size();
+	const double ts = UevaCtrl::samplePeriod;
+	CV_Assert(plant.A.type() == CV_64FC1 && plant.B.type() == CV_64FC1);
+	CV_Assert(plant.C.type() == CV_64FC1 && plant.D.type() == CV_64FC1);
+	CV_Assert(plant.C.cols == numState && plant.D.rows == numOutput && plant.D.cols == m);
+	CV_Assert((int)plant.isfbQ.total() == numState && (int)plant.obsrQ.total() == numState);
+	if (p == 0)
+	{
+		return false;
+	}
+
+	// reduced plant keeps positions of combination and every non position state
+	std::vector<int> stateIdx(combination);
+	for (int i = numOutput; i < numState; i++)
+	{
+		stateIdx.push_back(i);
+	}
+	const int n = (int)stateIdx.size();
+	for (int i = 0; i < p; i++)
+	{
+		CV_Assert(combination[i] >= 0 && combination[i] < numOutput && combination[i] < 256);
+	}
+
+	cv::Mat a(n, n, CV_64FC1);
+	cv::Mat b(n, m, CV_64FC1);
+	cv::Mat c(p, n, CV_64FC1);
+	cv::Mat d(p, m, CV_64FC1);
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			a.at<double>(i, j) = plant.A.at<double>(stateIdx[i], stateIdx[j]);
+		}
+		plant.B.row(stateIdx[i]).copyTo(b.row(i));
+	}
+	for (int i = 0; i < p; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			c.at<double>(i, j) = plant.C.at<double>(combination[i], stateIdx[j]);
+		}
+		plant.D.row(combination[i]).copyTo(d.row(i));
+	}
+	cv::Mat isfbQ, obsrQ;
+	plant.isfbQ.reshape(1, 1).convertTo(isfbQ, CV_64FC1);
+	plant.obsrQ.reshape(1, 1).convertTo(obsrQ, CV_64FC1);
+
+	// integral plant, lqr integral state feed back
+	cv::Mat az = cv::Mat::zeros(n + p, n + p, CV_64FC1);
+	a.copyTo(az(cv::Rect(0, 0, n, n)));
+	cv::Mat(c * ts).copyTo(az(cv::Rect(0, n, n, p)));
+	cv::Mat::eye(p, p, CV_64FC1).copyTo(az(cv::Rect(n, n, p, p)));
+	cv::Mat bz;
+	cv::vconcat(b, d * ts, bz);
+	cv::Mat qz = cv::Mat::zeros(n + p, n + p, CV_64FC1);
+	for (int i = 0; i < n; i++)
+	{
+		qz.at<double>(i, i) = isfbQ.at<double>(stateIdx[i]);
+	}
+	for (int i = n; i < n + p; i++)
+	{
+		qz.at<double>(i, i) = plant.isfbQIntegral;
+	}
+	cv::Mat rz = plant.isfbR * cv::Mat::eye(m, m, CV_64FC1);
+	cv::Mat kz;
+	if (!dlqr(az, bz, qz, rz, kz))
+	{
+		return false;
+	}
+
+	// lqr observer
+	cv::Mat q = cv::Mat::zeros(n, n, CV_64FC1);
+	for (int i = 0; i < n; i++)
+	{
+		q.at<double>(i, i) = obsrQ.at<double>(stateIdx[i]);
+	}
+	cv::Mat r = plant.obsrR * cv::Mat::eye(p, p, CV_64FC1);
+	cv::Mat h;
+	if (!dlqr(a.t(), c.t(), q, r, h))
+	{
+		return false;
+	}
+
+	// kalman filter with disturbance estimate
+	cv::Mat ad = cv::Mat::zeros(n + m, n + m, CV_64FC1);
+	a.copyTo(ad(cv::Rect(0, 0, n, n)));
+	cv::Mat(-b).copyTo(ad(cv::Rect(n, 0, m, n)));
+	cv::Mat::eye(m, m, CV_64FC1).copyTo(ad(cv::Rect(n, n, m, m)));
+	cv::Mat bd = cv::Mat::zeros(n + m, m, CV_64FC1);
+	b.copyTo(bd(cv::Rect(0, 0, m, n)));
+	cv::Mat cd = cv::Mat::zeros(p, n + m, CV_64FC1);
+	c.copyTo(cd(cv::Rect(0, 0, n, p)));
+
+	ctrl.uncoUnob = 0;
+	ctrl.n = n;
+	ctrl.m = m;
+	ctrl.p = p;
+	ctrl.outputIndices = cv::Mat(1, p, CV_8UC1);
+	for (int i = 0; i < p; i++)
+	{
+		ctrl.outputIndices.at<uchar>(i) = (uchar)combination[i];
+	}
+	ctrl.stateIndices = cv::Mat(1, n, CV_8UC1);
+	for (int i = 0; i < n; i++)
+	{
+		ctrl.stateIndices.at<uchar>(i) = (uchar)stateIdx[i];
+	}
+	ctrl.A = a;
+	ctrl.B = b;
+	ctrl.C = c;
+	ctrl.D = d;
+	ctrl.K1 = kz.colRange(0, n).clone();
+	ctrl.K2 = kz.colRange(n, n + p).clone();
+	ctrl.H = h.t();
+	ctrl.Ad = ad;
+	ctrl.Bd = bd;
+	ctrl.Cd = cd;
+	ctrl.Wd = cv::Mat::eye(n + m, n + m, CV_64FC1);
+	ctrl.steadyGain.release();
+	ctrl.steadyNoise = cv::Vec3d(-1.0, -1.0, -1.0);
+	return true;
+}
+
+//// DESIGNER
+
+UevaCtrlDesigner::UevaCtrlDesigner()
+{
+	stopping = false;
+	generation = 0;
+	start(QThread::LowPriority);
+}
+
+UevaCtrlDesigner::~UevaCtrlDesigner()
+{
+	stop();
+	wait();
+}
+
+void UevaCtrlDesigner::reset(const UevaPlant &p)
+{
+	mutex.lock();
+	plant = p;
+	generation++;
+	queued.clear();
+	finished.clear();
+	mutex.unlock();
+}
+
+void UevaCtrlDesigner::request(const uint64 mask, const std::vector<int> &combination)
+{
+	Design design;
+	design.mask = mask;
+	design.combination = combination;
+	design.ok = false;
+	mutex.lock();
+	queued.push_back(design);
+	mutex.unlock();
+	pending.release();
+}
+
+bool UevaCtrlDesigner::takeFinished(Design &design)
+{
+	mutex.lock();
+	bool taken = !finished.empty();
+	if (taken)
+	{
+		design = finished.front();
+		finished.pop_front();
+	}
+	mutex.unlock();
+	return taken;
+}
+
+void UevaCtrlDesigner::stop()
+{
+	stopping = true;
+	pending.release();
+}
+
+void UevaCtrlDesigner::run()
+{
+	while (!stopping)
+	{
+		pending.acquire();
+		mutex.lock();
+		if (stopping || queued.empty())
+		{
+			// queue was dropped by reset
+			mutex.unlock();
+			continue;
+		}
+		Design design = queued.front();
+		queued.pop_front();
+		UevaPlant p = plant;
+		int g = generation;
+		mutex.unlock();
+
+		design.ok = Ueva::designCtrl(p, design.combination, design.ctrl);
+
+		mutex.lock();
+		if (g == generation)
+		{
+			finished.push_back(design);
+		}
+		mutex.unlock();
+	}
+}
+
+//// CACHE
+
+UevaCtrlCache::UevaCtrlCache()
+{
+	firstSlot = 0;
+	capacity = 0;
+}
+
+void UevaCtrlCache::reset(const UevaPlant &p, const int first, const int size)
+{
+	plant = p;
+	firstSlot = first;
+	capacity = size;
+	recent.clear();
+	positions.clear();
+	masks.clear();
+	infeasible.clear();
+	requested.clear();
+	designer.reset(p);
+}
+
+bool UevaCtrlCache::isActive() const
+{
+	return !plant.empty() && capacity > 0;
+}
+
+void UevaCtrlCache::touch(const int slot)
+{
+	int designed = slot - firstSlot;
+	if (designed < 0 || designed >= (int)positions.size())
+	{
+		return;
+	}
+	recent.splice(recent.begin(), recent, positions[designed]);
+}
+
+bool UevaCtrlCache::combinationMask(const std::vector<int> &combination, uint64 &mask) const
+{
+	mask = 0;
+	for (int i = 0; i < combination.size(); i++)
+	{
+		if (combination[i] < 0 || combination[i] >= 64 || combination[i] >= plant.C.rows ||
+			(i > 0 && combination[i] <= combination[i - 1]))
+		{
+			return false;
+		}
+		mask |= (uint64)1 << combination[i];
+	}
+	return !combination.empty();
+}
+
+void UevaCtrlCache::request(const std::vector<int> &combination, const UevaCtrlLookup &lookup)
+{
+	uint64 mask;
+	if (!isActive() || !combinationMask(combination, mask))
+	{
+		return;
+	}
+	if (lookup.count(mask) || requested.count(mask) || infeasible.count(mask))
+	{
+		return;
+	}
+	requested.insert(mask);
+	designer.request(mask, combination);
+}
+
+void UevaCtrlCache::collect(std::vector<UevaCtrl> &ctrls, UevaCtrlLookup &lookup)
+{
+	UevaCtrlDesigner::Design design;
+	while (designer.takeFinished(design))
+	{
+		requested.erase(design.mask);
+		if (!design.ok)
+		{
+			qDebug() << "controller design failed, channel mask " << (qulonglong)design.mask << endl;
+			infeasible.insert(design.mask);
+			continue;
+		}
+
+		int slot;
+		if ((int)masks.size() < capacity)
+		{
+			// grow
+			CV_Assert((int)ctrls.size() == firstSlot + (int)masks.size());
+			slot = (int)ctrls.size();
+			ctrls.push_back(design.ctrl);
+			masks.push_back(design.mask);
+			recent.push_front(slot);
+			positions.push_back(recent.begin());
+		}
+		else
+		{
+			// replace least recently used, never the one engine runs on
+			std::list<int>::reverse_iterator victim = recent.rbegin();
+			while (victim != recent.rend() && *victim == UevaCtrl::index)
+			{
+				victim++;
+			}
+			if (victim == recent.rend())
+			{
+				continue;
+			}
+			slot = *victim;
+			UevaCtrlLookup::iterator old = lookup.find(masks[slot - firstSlot]);
+			if (old != lookup.end() && old->second == slot)
+			{
+				lookup.erase(old);
+			}
+			ctrls[slot] = design.ctrl;
+			masks[slot - firstSlot] = design.mask;
+			touch(slot);
+		}
+		lookup[design.mask] = slot;
+	}
+}
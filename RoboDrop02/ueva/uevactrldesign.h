@@ -0,0 +1,118 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVACTRLDESIGN_H
+#define UEVACTRLDESIGN_H
+
+#include <vector>
+#include <list>
+#include <unordered_set>
+#include <atomic>
+#include <QtGui >
+#include <QThread >
+#include <QMutex >
+#include <QSemaphore >
+#include "opencv2/core.hpp"
+
+#include "uevastructures.h"
+
+namespace Ueva
+{
+	// stabilizing solution of discrete algebraic riccati equation by structure preserving doubling
+	// p = a' p a - a' p b inv(r + b' p b) b' p a + q, false when it does not converge
+	bool solveDare(const cv::Mat &a, const cv::Mat &b, const cv::Mat &q, const cv::Mat &r, cv::Mat &p);
+
+	// same gain as matlab dlqr, u = -k x
+	bool dlqr(const cv::Mat &a, const cv::Mat &b, const cv::Mat &q, const cv::Mat &r, cv::Mat &k);
+
+	// same reduction, weights and kalman augmentation as model_ctrl/step2_design_controller.m
+	// combination is sorted channel indices, false when either riccati equation has no solution
+	bool designCtrl(const UevaPlant &plant, const std::vector<int> &combination, UevaCtrl &ctrl);
+}
+
+// designs requested combinations one after another, so engine never waits for a riccati solve
+class UevaCtrlDesigner : public QThread
+{
+public:
+	UevaCtrlDesigner();
+	~UevaCtrlDesigner();
+
+	struct Design
+	{
+		uint64 mask;
+		std::vector<int> combination;
+		bool ok;
+		UevaCtrl ctrl;
+	};
+
+	// engine thread, queued and unfinished designs of old plant are dropped
+	void reset(const UevaPlant &plant);
+	void request(const uint64 mask, const std::vector<int> &combination);
+	bool takeFinished(Design &design); // false when nothing finished
+	void stop();
+
+protected:
+	void run();
+
+private:
+	QMutex mutex; // never held while designing
+	QSemaphore pending; // one per queued design
+	std::atomic<bool> stopping;
+	UevaPlant plant;
+	int generation; // bumped by reset, designs of older plant are thrown away
+	std::list<Design> queued;
+	std::list<Design> finished;
+};
+
+// controllers designed at run time, kept in ctrls after the ones loaded from file
+// least recently used one is replaced when cache is full
+class UevaCtrlCache
+{
+public:
+	UevaCtrlCache();
+
+	// empty plant disables design
+	void reset(const UevaPlant &plant, const int firstSlot, const int capacity);
+	bool isActive() const;
+
+	// slot of ctrls was selected, keeps it from being replaced
+	void touch(const int slot);
+
+	// queue design of sorted combination on designer thread, nothing happens if it is queued, designed or infeasible
+	void request(const std::vector<int> &combination, const UevaCtrlLookup &lookup);
+
+	// put finished designs into slots and index them in lookup, UevaCtrl::index is left alone
+	void collect(std::vector<UevaCtrl> &ctrls, UevaCtrlLookup &lookup);
+
+private:
+	bool combinationMask(const std::vector<int> &combination, uint64 &mask) const;
+
+	UevaCtrlDesigner designer;
+	std::unordered_set<uint64> requested; // queued or being designed
+	UevaPlant plant;
+	int firstSlot; // slots before this are loaded from file and never replaced
+	int capacity;
+	std::list<int> recent; // designed slots, most recently used first
+	std::vector<std::list<int>::iterator> positions; // of each designed slot in recent
+	std::vector<uint64> masks; // combination held by each designed slot
+	std::unordered_set<uint64> infeasible; // combinations design failed for, not retried
+};
+
+#endif // UEVACTRLDESIGN_H
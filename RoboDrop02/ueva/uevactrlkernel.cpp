@@ -0,0 +1,470 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "uevactrlkernel.h"
+#include "uevactrldesign.h"
+
+//// DIMENSIONS
+
+// sizes known at compile time, loops fully unroll
+template <int N, int M, int P>
+struct UevaCtrlFixedDims
+{
+	static inline int n(const UevaCtrlKernel &) { return N; }
+	static inline int m(const UevaCtrlKernel &) { return M; }
+	static inline int p(const UevaCtrlKernel &) { return P; }
+};
+
+// sizes read from kernel, any controller
+struct UevaCtrlDynamicDims
+{
+	static inline int n(const UevaCtrlKernel &kernel) { return kernel.n; }
+	static inline int m(const UevaCtrlKernel &kernel) { return kernel.m; }
+	static inline int p(const UevaCtrlKernel &kernel) { return kernel.p; }
+};
+
+//// HELPERS
+
+static void flatten(const cv::Mat &src, const int rows, const int cols, std::vector<double> &dst)
+{
+	CV_Assert(src.rows == rows && src.cols == cols);
+	cv::Mat mat;
+	src.convertTo(mat, CV_64FC1);
+	dst.resize(rows * cols);
+	for (int i = 0; i < rows; i++)
+	{
+		const double *row = mat.ptr<double>(i);
+		for (int j = 0; j < cols; j++)
+		{
+			dst[i * cols + j] = row[j];
+		}
+	}
+}
+
+static void flattenIndices(const cv::Mat &src, const int count, std::vector<int> &dst)
+{
+	CV_Assert((int)src.total() == count);
+	cv::Mat mat;
+	src.convertTo(mat, CV_32SC1);
+	mat = mat.reshape(1, 1);
+	dst.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		dst[i] = mat.at<int>(i);
+	}
+}
+
+// c = a * b, a is rows x inner, b is inner x cols
+static inline void multiply(const double *a, const double *b, double *c,
+	const int rows, const int inner, const int cols)
+{
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			double sum = 0.0;
+			for (int l = 0; l < inner; l++)
+			{
+				sum += a[i * inner + l] * b[l * cols + j];
+			}
+			c[i * cols + j] = sum;
+		}
+	}
+}
+
+// c = a * b', a is rows x inner, b is cols x inner
+static inline void multiplyTransposed(const double *a, const double *b, double *c,
+	const int rows, const int inner, const int cols)
+{
+	for (int i = 0; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			double sum = 0.0;
+			for (int l = 0; l < inner; l++)
+			{
+				sum += a[i * inner + l] * b[j * inner + l];
+			}
+			c[i * cols + j] = sum;
+		}
+	}
+}
+
+// c = a * x + b * v, a is rows x na, b is rows x nb
+static inline void multiplyAdd(const double *a, const double *x, const int na,
+	const double *b, const double *v, const int nb, double *c, const int rows)
+{
+	for (int i = 0; i < rows; i++)
+	{
+		double sum = 0.0;
+		for (int l = 0; l < na; l++)
+		{
+			sum += a[i * na + l] * x[l];
+		}
+		for (int l = 0; l < nb; l++)
+		{
+			sum += b[i * nb + l] * v[l];
+		}
+		c[i] = sum;
+	}
+}
+
+// lower cholesky factor of symmetric positive definite s in place, false when not positive definite
+static inline bool cholesky(double *s, const int size)
+{
+	for (int j = 0; j < size; j++)
+	{
+		double d = s[j * size + j];
+		for (int l = 0; l < j; l++)
+		{
+			d -= s[j * size + l] * s[j * size + l];
+		}
+		if (!(d > 0.0))
+		{
+			return false;
+		}
+		d = std::sqrt(d);
+		s[j * size + j] = d;
+		for (int i = j + 1; i < size; i++)
+		{
+			double v = s[i * size + j];
+			for (int l = 0; l < j; l++)
+			{
+				v -= s[i * size + l] * s[j * size + l];
+			}
+			s[i * size + j] = v / d;
+		}
+	}
+	return true;
+}
+
+// solve l * l' * x = b in place, l from cholesky
+static inline void choleskySolve(const double *l, double *x, const int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		double v = x[i];
+		for (int j = 0; j < i; j++)
+		{
+			v -= l[i * size + j] * x[j];
+		}
+		x[i] = v / l[i * size + i];
+	}
+	for (int i = size - 1; i >= 0; i--)
+	{
+		double v = x[i];
+		for (int j = i + 1; j < size; j++)
+		{
+			v -= l[j * size + i] * x[j];
+		}
+		x[i] = v / l[i * size + i];
+	}
+}
+
+//// STEP
+
+// riccati recursion, pe and k of next tick from pe of this tick
+template <class Dims>
+static void gainStep(UevaCtrlKernel &kernel)
+{
+	const int n = Dims::n(kernel);
+	const int m = Dims::m(kernel);
+	const int p = Dims::p(kernel);
+	const int q = n + m;
+
+	double *pe = &kernel.pe[0];
+	double *pp = &kernel.pp[0];
+	double *k = &kernel.k[0];
+	double *qq = &kernel.qq[0];
+	double *qp = &kernel.qp[0];
+	double *s = &kernel.s[0];
+	const double *Ad = &kernel.Ad[0];
+	const double *Cd = &kernel.Cd[0];
+	const double *WRW = &kernel.WRW[0];
+
+	// pp = Ad pe Ad' + Wd rw Wd'
+	multiply(Ad, pe, qq, q, q, q);
+	multiplyTransposed(qq, Ad, pp, q, q, q);
+	for (int i = 0; i < q * q; i++)
+	{
+		pp[i] += WRW[i];
+	}
+	// pp Cd', then innovation cov Cd pp Cd' + rv
+	multiplyTransposed(pp, Cd, qp, q, q, p);
+	multiply(Cd, qp, s, p, q, p);
+	for (int i = 0; i < p; i++)
+	{
+		s[i * p + i] += kernel.sensorCov;
+	}
+	// k = pp Cd' inv(s), solved row by row since s is symmetric
+	if (cholesky(s, p))
+	{
+		for (int i = 0; i < q; i++)
+		{
+			for (int j = 0; j < p; j++)
+			{
+				k[i * p + j] = qp[i * p + j];
+			}
+			choleskySolve(s, k + i * p, p);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < q * p; i++)
+		{
+			k[i] = 0.0;
+		}
+	}
+	// pe = (I - k Cd) pp = pp - k (pp Cd')'
+	multiplyTransposed(k, qp, pe, q, p, q);
+	for (int i = 0; i < q * q; i++)
+	{
+		pe[i] = pp[i] - pe[i];
+	}
+}
+
+template <class Dims>
+static void ctrlStep(UevaCtrlKernel &kernel)
+{
+	const int n = Dims::n(kernel);
+	const int m = Dims::m(kernel);
+	const int p = Dims::p(kernel);
+	const int q = n + m;
+
+	if (kernel.timeVarying)
+	{
+		gainStep<Dims>(kernel);
+	}
+
+	const double *k = &kernel.k[0];
+	double *e = &kernel.e[0];
+	double *t = &kernel.t[0];
+	double *y = &kernel.y[0];
+	double *r = &kernel.r[0];
+	double *z = &kernel.z[0];
+	double *yk = &kernel.yk[0];
+	double *yl = &kernel.yl[0];
+	double *xe = &kernel.xe[0];
+	double *xp = &kernel.xp[0];
+	double *xl = &kernel.xl[0];
+	double *u = &kernel.u[0];
+	const double *Ad = &kernel.Ad[0];
+	const double *Bd = &kernel.Bd[0];
+	const double *Cd = &kernel.Cd[0];
+
+	// kalman filter, xp = Ad xe + Bd u, yk = Cd xp, xe = xp + k (y - yk)
+	multiplyAdd(Ad, xe, q, Bd, u, m, xp, q);
+	multiply(Cd, xp, yk, p, q, 1);
+	for (int i = 0; i < p; i++)
+	{
+		e[i] = y[i] - yk[i];
+	}
+	multiply(k, e, xe, q, p, 1);
+	for (int i = 0; i < q; i++)
+	{
+		xe[i] += xp[i];
+	}
+
+	// luenburger, yl = C xl + D u, xl = A xl + B u + H (y - yl)
+	multiplyAdd(&kernel.C[0], xl, n, &kernel.D[0], u, m, yl, p);
+	for (int i = 0; i < p; i++)
+	{
+		e[i] = y[i] - yl[i];
+	}
+	multiplyAdd(&kernel.A[0], xl, n, &kernel.B[0], u, m, t, n);
+	for (int i = 0; i < n; i++)
+	{
+		const double *h = &kernel.H[i * p];
+		double sum = 0.0;
+		for (int j = 0; j < p; j++)
+		{
+			sum += h[j] * e[j];
+		}
+		xl[i] = t[i] + sum;
+	}
+
+	// integral state feed back, z += Ts (y - r), u = -K1 xl - K2 z
+	for (int i = 0; i < p; i++)
+	{
+		z[i] += UevaCtrl::samplePeriod * (y[i] - r[i]);
+	}
+	multiplyAdd(&kernel.K1[0], xl, n, &kernel.K2[0], z, p, u, m);
+	for (int i = 0; i < m; i++)
+	{
+		u[i] = -u[i];
+	}
+}
+
+//// KERNEL
+
+UevaCtrlKernel::UevaCtrlKernel()
+{
+	index = -1;
+	noise = cv::Vec3d(0.0, 0.0, 0.0);
+	steady = false;
+	timeVarying = true;
+	n = 0;
+	m = 0;
+	p = 0;
+	q = 0;
+	sensorCov = 0.0;
+	stepFunction = 0;
+	fixedSize = false;
+}
+
+void UevaCtrlKernel::select(const UevaCtrl &ctrl, const int ctrlIndex,
+	const double modelCov, const double disturbanceCov, const double sensorNoiseCov,
+	const bool steadyRequest)
+{
+	CV_Assert(ctrl.n > 0 && ctrl.m > 0 && ctrl.p > 0);
+	index = ctrlIndex;
+	noise = cv::Vec3d(modelCov, disturbanceCov, sensorNoiseCov);
+	steady = steadyRequest;
+	n = ctrl.n;
+	m = ctrl.m;
+	p = ctrl.p;
+	q = n + m;
+	sensorCov = sensorNoiseCov;
+
+	flattenIndices(ctrl.outputIndices, p, outputIndices);
+	flattenIndices(ctrl.stateIndices, n, stateIndices);
+
+	flatten(ctrl.A, n, n, A);
+	flatten(ctrl.B, n, m, B);
+	flatten(ctrl.C, p, n, C);
+	flatten(ctrl.D, p, m, D);
+	flatten(ctrl.K1, m, n, K1);
+	flatten(ctrl.K2, m, p, K2);
+	flatten(ctrl.H, n, p, H);
+	flatten(ctrl.Ad, q, q, Ad);
+	flatten(ctrl.Bd, q, m, Bd);
+	flatten(ctrl.Cd, p, q, Cd);
+
+	// Wd rw Wd' with rw = blockdiag(model cov I_n, disturbance cov I_m)
+	std::vector<double> Wd;
+	flatten(ctrl.Wd, q, q, Wd);
+	WRW.assign(q * q, 0.0);
+	for (int i = 0; i < q; i++)
+	{
+		for (int j = 0; j < q; j++)
+		{
+			double sum = 0.0;
+			for (int l = 0; l < q; l++)
+			{
+				sum += Wd[i * q + l] * Wd[j * q + l] * (l < n ? modelCov : disturbanceCov);
+			}
+			WRW[i * q + j] = sum;
+		}
+	}
+
+	// posterior error cov starts large
+	pe.assign(q * q, 0.0);
+	for (int i = 0; i < q; i++)
+	{
+		pe[i * q + i] = 1000.0;
+	}
+	pp.assign(q * q, 0.0);
+	k.assign(q * p, 0.0);
+	timeVarying = true;
+	if (steady && !ctrl.steadyGain.empty())
+	{
+		flatten(ctrl.steadyGain, q, p, k);
+		timeVarying = false;
+	}
+
+	r.assign(p, 0.0);
+	dr.assign(p, 0.0);
+	y.assign(p, 0.0);
+	yRaw.assign(p, 0.0);
+	yOff.assign(p, 0.0);
+	yk.assign(p, 0.0);
+	yl.assign(p, 0.0);
+	z.assign(p, 0.0);
+	xe.assign(q, 0.0);
+	xp.assign(q, 0.0);
+	xl.assign(n, 0.0);
+	u.assign(m, 0.0);
+
+	qq.assign(q * q, 0.0);
+	qp.assign(q * p, 0.0);
+	s.assign(p * p, 0.0);
+	e.assign(p, 0.0);
+	t.assign(n, 0.0);
+
+	// sizes of controllers shipped in model_ctrl, others take dynamic path
+	fixedSize = true;
+	if (n == 11 && m == 3 && p == 1)
+		stepFunction = &ctrlStep<UevaCtrlFixedDims<11, 3, 1> >;
+	else if (n == 12 && m == 3 && p == 2)
+		stepFunction = &ctrlStep<UevaCtrlFixedDims<12, 3, 2> >;
+	else if (n == 16 && m == 4 && p == 1)
+		stepFunction = &ctrlStep<UevaCtrlFixedDims<16, 4, 1> >;
+	else if (n == 17 && m == 4 && p == 2)
+		stepFunction = &ctrlStep<UevaCtrlFixedDims<17, 4, 2> >;
+	else if (n == 18 && m == 4 && p == 3)
+		stepFunction = &ctrlStep<UevaCtrlFixedDims<18, 4, 3> >;
+	else
+	{
+		stepFunction = &ctrlStep<UevaCtrlDynamicDims>;
+		fixedSize = false;
+	}
+}
+
+void UevaCtrlKernel::step()
+{
+	CV_Assert(stepFunction);
+	stepFunction(*this);
+}
+
+bool UevaCtrlKernel::isFixedSize() const
+{
+	return fixedSize;
+}
+
+bool UevaCtrlKernel::solveSteadyGain(const UevaCtrl &ctrl,
+	const double modelCov, const double disturbanceCov, const double sensorNoiseCov,
+	cv::Mat &gain)
+{
+	const int q = ctrl.n + ctrl.m;
+	gain.release();
+
+	// same process and sensor noise the time varying filter propagates
+	cv::Mat rw = cv::Mat::zeros(q, q, CV_64FC1);
+	for (int i = 0; i < q; i++)
+	{
+		rw.at<double>(i, i) = i < ctrl.n ? modelCov : disturbanceCov;
+	}
+	cv::Mat wrw = ctrl.Wd * rw * ctrl.Wd.t();
+	cv::Mat rv = sensorNoiseCov * cv::Mat::eye(ctrl.p, ctrl.p, CV_64FC1);
+
+	// prior error cov, k = pp Cd' inv(Cd pp Cd' + rv)
+	cv::Mat pp;
+	if (!Ueva::solveDare(ctrl.Ad.t(), ctrl.Cd.t(), wrw, rv, pp))
+	{
+		return false;
+	}
+	cv::Mat kt;
+	if (!cv::solve(ctrl.Cd * pp * ctrl.Cd.t() + rv, ctrl.Cd * pp, kt, cv::DECOMP_CHOLESKY))
+	{
+		return false;
+	}
+	gain = kt.t();
+	return true;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVACTRLKERNEL_H
+#define UEVACTRLKERNEL_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "opencv2/core.hpp"
+
+#include "uevastructures.h"
+
+// kalman disturbance estimator, luenburger observer and integral state feed back of one controller
+// all matrices are flattened row major when a controller is selected, a control tick never allocates
+struct UevaCtrlKernel
+{
+	UevaCtrlKernel();
+
+	// copy selected controller, reset covariance and pick fixed size step when one is compiled for its size
+	// steadyRequest uses ctrl.steadyGain and skips covariance propagation, time varying filter when gain is empty
+	void select(const UevaCtrl &ctrl, const int ctrlIndex,
+		const double modelCov, const double disturbanceCov, const double sensorNoiseCov,
+		const bool steadyRequest = false);
+	// one tick, reads y r z xe xl u, writes everything else
+	void step();
+	bool isFixedSize() const;
+
+	// gain the time varying filter settles to, from riccati equation of dual problem, gain is q x p
+	// false when it has no stabilizing solution
+	static bool solveSteadyGain(const UevaCtrl &ctrl,
+		const double modelCov, const double disturbanceCov, const double sensorNoiseCov,
+		cv::Mat &gain);
+
+	int index; // controller this kernel was selected for, -1 before first select
+	cv::Vec3d noise; // model, disturbance and sensor cov of this selection
+	bool steady; // steady state gain requested
+	bool timeVarying; // covariance and gain propagated every tick
+	int n; // plant state
+	int m; // plant input, also disturbance state
+	int p; // plant output
+	int q; // kalman state, n + m
+	std::vector<int> outputIndices;
+	std::vector<int> stateIndices;
+
+	// model
+	std::vector<double> A; // n x n
+	std::vector<double> B; // n x m
+	std::vector<double> C; // p x n
+	std::vector<double> D; // p x m
+	std::vector<double> K1; // m x n
+	std::vector<double> K2; // m x p
+	std::vector<double> H; // n x p
+	std::vector<double> Ad; // q x q
+	std::vector<double> Bd; // q x m
+	std::vector<double> Cd; // p x q
+	std::vector<double> WRW; // q x q, Wd * process noise cov * Wd', constant between selects
+	double sensorCov; // diagonal of sensor noise cov
+
+	// kalman
+	std::vector<double> pe; // q x q posterior error cov
+	std::vector<double> pp; // q x q prior error cov
+	std::vector<double> k; // q x p gain, constant when not time varying
+
+	// signals
+	std::vector<double> r; // p
+	std::vector<double> dr; // p
+	std::vector<double> y; // p
+	std::vector<double> yRaw; // p
+	std::vector<double> yOff; // p
+	std::vector<double> yk; // p
+	std::vector<double> yl; // p
+	std::vector<double> z; // p
+	std::vector<double> xe; // q
+	std::vector<double> xp; // q
+	std::vector<double> xl; // n
+	std::vector<double> u; // m
+
+	// scratch
+	std::vector<double> qq; // q x q
+	std::vector<double> qp; // q x p
+	std::vector<double> s; // p x p innovation cov, cholesky factor in place
+	std::vector<double> e; // p innovation
+	std::vector<double> t; // n next luenburger state
+
+	typedef void (*StepFunction)(UevaCtrlKernel &kernel);
+	StepFunction stepFunction;
+	bool fixedSize;
+};
+
+#endif // UEVACTRLKERNEL_H
@@ -0,0 +1,188 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "uevaframepool.h"
+
+#include <new>
+#include <cstdlib>
+
+//// BUFFER LAYOUT
+
+// buffer = header, UMatData, pixels, so handing out a frame needs no heap allocation
+struct UevaFrameHeader
+{
+	void *origin; // unaligned block from malloc
+	int generation;
+};
+
+static const size_t FRAME_ALIGNMENT = 64; // cache line, also enough for avx2 loads
+static const size_t FRAME_UMAT_OFFSET =
+	(sizeof(UevaFrameHeader) + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+static const size_t FRAME_HEADER_BYTES =
+	(FRAME_UMAT_OFFSET + sizeof(cv::UMatData) + FRAME_ALIGNMENT - 1) / FRAME_ALIGNMENT * FRAME_ALIGNMENT;
+
+//// POOL
+
+UevaFramePool::UevaFramePool(const int c)
+{
+	capacity = c;
+	bufferBytes = 0;
+	generation = 0;
+	missCount = 0;
+}
+
+UevaFramePool::~UevaFramePool()
+{
+	QMutexLocker locker(&mutex);
+	for (int i = 0; i < freeBuffers.size(); i++)
+	{
+		freeBuffer(freeBuffers[i]);
+	}
+	freeBuffers.clear();
+}
+
+void UevaFramePool::reserve(const size_t bytes)
+{
+	QMutexLocker locker(&mutex);
+	if (bytes == bufferBytes && generation > 0)
+	{
+		return;
+	}
+	for (int i = 0; i < freeBuffers.size(); i++)
+	{
+		freeBuffer(freeBuffers[i]);
+	}
+	freeBuffers.clear();
+	bufferBytes = bytes;
+	generation++;
+	missCount = 0;
+	for (int i = 0; i < capacity; i++)
+	{
+		freeBuffers.push_back(makeBuffer());
+	}
+}
+
+int UevaFramePool::available() const
+{
+	QMutexLocker locker(&mutex);
+	return (int)freeBuffers.size();
+}
+
+int UevaFramePool::misses() const
+{
+	QMutexLocker locker(&mutex);
+	return missCount;
+}
+
+uchar *UevaFramePool::makeBuffer() const
+{
+	void *origin = std::malloc(FRAME_HEADER_BYTES + bufferBytes + FRAME_ALIGNMENT);
+	if (!origin)
+	{
+		CV_Error(cv::Error::StsNoMem, "frame pool out of memory");
+	}
+	size_t address = (reinterpret_cast<size_t>(origin) + FRAME_ALIGNMENT - 1) & ~(FRAME_ALIGNMENT - 1);
+	uchar *buffer = reinterpret_cast<uchar *>(address);
+	UevaFrameHeader *header = reinterpret_cast<UevaFrameHeader *>(buffer);
+	header->origin = origin;
+	header->generation = generation;
+	return buffer;
+}
+
+void UevaFramePool::freeBuffer(uchar *buffer) const
+{
+	std::free(reinterpret_cast<UevaFrameHeader *>(buffer)->origin);
+}
+
+cv::UMatData *UevaFramePool::allocate(int dims, const int *sizes, int type,
+	void *data, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const
+{
+	// user data and oversized requests are not ours
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--)
+	{
+		total *= sizes[i];
+	}
+	uchar *buffer = 0;
+	if (!data)
+	{
+		QMutexLocker locker(&mutex);
+		if (total <= bufferBytes && !freeBuffers.empty())
+		{
+			buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+		}
+		else
+		{
+			missCount++;
+		}
+	}
+	if (!buffer)
+	{
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	// continuous steps, same as default allocator
+	if (step)
+	{
+		size_t s = CV_ELEM_SIZE(type);
+		for (int i = dims - 1; i >= 0; i--)
+		{
+			step[i] = s;
+			s *= sizes[i];
+		}
+	}
+	cv::UMatData *u = new (buffer + FRAME_UMAT_OFFSET) cv::UMatData(this);
+	u->data = u->origdata = buffer + FRAME_HEADER_BYTES;
+	u->size = total;
+	return u;
+}
+
+bool UevaFramePool::allocate(cv::UMatData *u, int, cv::UMatUsageFlags) const
+{
+	return u != 0;
+}
+
+void UevaFramePool::deallocate(cv::UMatData *u) const
+{
+	if (!u)
+	{
+		return;
+	}
+	CV_Assert(u->urefcount >= 0);
+	CV_Assert(u->refcount >= 0);
+	if (u->refcount != 0)
+	{
+		return;
+	}
+	uchar *buffer = reinterpret_cast<uchar *>(u) - FRAME_UMAT_OFFSET;
+	int bufferGeneration = reinterpret_cast<UevaFrameHeader *>(buffer)->generation;
+	u->~UMatData();
+
+	QMutexLocker locker(&mutex);
+	if (bufferGeneration == generation && (int)freeBuffers.size() < capacity)
+	{
+		freeBuffers.push_back(buffer);
+	}
+	else
+	{
+		freeBuffer(buffer);
+	}
+}
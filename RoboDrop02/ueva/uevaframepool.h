@@ -0,0 +1,63 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVAFRAMEPOOL_H
+#define UEVAFRAMEPOOL_H
+
+#include <vector>
+#include <QMutex>
+#include "opencv2/core.hpp"
+
+// fixed set of aligned frame buffers handed out through cv::Mat
+// a buffer goes back to the pool when the last Mat sharing it is released, wherever that happens
+// set as allocator of a Mat before create, requests larger than the pool or beyond capacity fall back to heap
+// must outlive every Mat it allocated
+class UevaFramePool : public cv::MatAllocator
+{
+public:
+	explicit UevaFramePool(const int capacity);
+	~UevaFramePool();
+
+	// make capacity buffers of at least bytes each, buffers still in use are freed when they come back
+	void reserve(const size_t bytes);
+	int available() const; // buffers ready to hand out
+	int misses() const; // allocations that fell back to heap since reserve
+
+	cv::UMatData *allocate(int dims, const int *sizes, int type,
+		void *data, size_t *step, int flags, cv::UMatUsageFlags usageFlags) const;
+	bool allocate(cv::UMatData *data, int accessFlags, cv::UMatUsageFlags usageFlags) const;
+	void deallocate(cv::UMatData *data) const;
+
+private:
+	UevaFramePool(const UevaFramePool &);
+	UevaFramePool &operator=(const UevaFramePool &);
+
+	uchar *makeBuffer() const;
+	void freeBuffer(uchar *buffer) const;
+
+	int capacity;
+	size_t bufferBytes; // pixel bytes of every buffer of this generation
+	int generation; // bumped by reserve, older buffers are freed on return
+	mutable QMutex mutex; // buffers come back on whichever thread releases the last Mat
+	mutable std::vector<uchar *> freeBuffers;
+	mutable int missCount;
+};
+
+#endif // UEVAFRAMEPOOL_H
@@ -0,0 +1,68 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVAFRAMESOURCE_H
+#define UEVAFRAMESOURCE_H
+
+#include <QMap>
+#include <QString>
+#include "opencv2/core.hpp"
+
+// define UEVA_NO_ANDOR to build without andor sdk, replay is then the only source
+
+struct UevaFrameInfo
+{
+	UevaFrameInfo();
+
+	qint64 sequence; // frame number since start, counts dropped frames too, -1 before first frame
+	double timestamp; // seconds on source clock since start, -1 when source has none
+	qint64 hostNs; // arrival on host since start, monotonic
+};
+
+// anything camera thread pulls frames from, only called from camera thread or under its camera mutex
+class UevaFrameSource
+{
+public:
+	virtual ~UevaFrameSource();
+
+	//// SETTINGS AS SHOWN IN SETUP TREE
+	virtual QMap<QString, QString> defaultSettings() = 0;
+	virtual QMap<QString, QString> getSettings() = 0;
+	virtual void setSettings(const QMap<QString, QString> &s) = 0;
+
+	//// ACQUISITION
+	virtual void start(const int &periodMs) = 0; // periodMs is sample period of engine
+	virtual void stop() = 0;
+	// wait at most timeout ms for next frame, false when none arrived
+	// gray is created with its own allocator so caller can hand in a pool
+	virtual bool processGray(cv::Mat &gray, const unsigned int timeout = 0, const bool parallel = false) = 0;
+	// read out only roi of current image, only while not acquiring
+	// roi becomes what source accepted in same coordinates, false and old aoi kept when refused
+	virtual bool cropAoi(cv::Rect_<int> &roi) = 0;
+
+	//// BOOKKEEPING
+	virtual cv::Size_<int> frameSize() const = 0; // valid after start
+	virtual const UevaFrameInfo &frameInfo() const = 0; // of frame last returned by processGray
+	virtual qint64 droppedFrames() const = 0; // made by source but never delivered, -1 when source can not tell
+	virtual int overflows() const = 0; // source ran out of buffers
+	virtual bool holdsFrames() const; // next frame waits until previous one is taken, so none is lost
+};
+
+#endif // UEVAFRAMESOURCE_H
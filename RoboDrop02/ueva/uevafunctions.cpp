@@ -71,107 +71,937 @@ cv::Mat Ueva::contour2Mask(const std::vector< cv::Point_<int> > &contour, const
 	return mask;
 }
 
-std::vector<cv::Point_<int>> Ueva::mask2Contour(const cv::Mat &mask)
+cv::Mat Ueva::contour2Mask(const std::vector< cv::Point_<int> > &contour, const cv::Rect_<int> &roi)
+{
+	// mask only as big as roi, contour stays in frame coordinates
+	std::vector< std::vector< cv::Point_<int> >> contours;
+	contours.push_back(contour);
+	cv::Mat mask = cv::Mat(roi.size(), CV_8UC1, cv::Scalar_<int>(0));
+	cv::drawContours(mask, contours, -1, cv::Scalar_<int>(255), -1, 8, cv::noArray(), INT_MAX, -roi.tl());
+	return mask;
+}
+
+std::vector<cv::Point_<int>> Ueva::mask2Contour(const cv::Mat &mask, const cv::Point_<int> &offset)
 {
 	std::vector<std::vector< cv::Point_<int> >> contours;
-	cv::findContours(mask, contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+	cv::findContours(mask, contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE, offset);
 	return contours[0];
 }
 
+cv::Mat Ueva::channels2Map(const std::vector<UevaChannel> &channels, const cv::Size_<int> &sz)
+{
+	// 0 is no channel, otherwise channel index + 1
+	CV_Assert(channels.size() < 255);
+	cv::Mat channelMap = cv::Mat(sz, CV_8UC1, cv::Scalar_<int>(0));
+	for (int i = 0; i < channels.size(); i++)
+	{
+		channelMap(channels[i].rect).setTo(cv::Scalar_<int>(channels[i].index + 1), channels[i].mask);
+	}
+	return channelMap;
+}
+
+int Ueva::markerToChannel(const UevaMarker &marker, const cv::Mat &channelMap)
+{
+	if (marker.centroid.x < 0 || marker.centroid.x >= channelMap.cols ||
+		marker.centroid.y < 0 || marker.centroid.y >= channelMap.rows)
+	{
+		return -1;
+	}
+	return int(channelMap.ptr<uchar>(marker.centroid.y)[marker.centroid.x]) - 1;
+}
+
 void Ueva::bigPassFilter(std::vector<std::vector< cv::Point_<int> >> &contours, const int size)
 {
-	std::vector<std::vector< cv::Point_<int> >>::iterator iter;
-	iter = contours.begin();
-	while (iter != contours.end())
+	// compact survivors to the front in one pass, erase once at the end
+	int kept = 0;
+	for (int i = 0; i < contours.size(); i++)
+	{
+		if (cv::contourArea(contours[i]) >= size)
+		{
+			if (kept != i)
+			{
+				contours[kept].swap(contours[i]);
+			}
+			kept++;
+		}
+	}
+	contours.resize(kept);
+}
+
+void Ueva::extractMarkers(const cv::Mat &allMarkers, const UevaSettings &settings, const cv::Point_<int> &offset,
+	UevaBlobScratch &blobs, std::vector<UevaMarker> &markers)
+{
+	// one labelling pass gives area, bounding box and centroid of every blob, small blobs dropped on the spot
+	markers.clear();
+	int numLabels = cv::connectedComponentsWithStats(allMarkers, blobs.labels, blobs.stats, blobs.centroids, 8, CV_32S);
+	for (int i = 1; i < numLabels; i++) // label 0 is background
 	{
-		cv::Moments mom = cv::moments(*iter);
-		if (mom.m00 < size)
+		const int *stat = blobs.stats.ptr<int>(i);
+		if (stat[cv::CC_STAT_AREA] < settings.imgprogContourSize)
+		{
+			continue;
+		}
+		const double *c = blobs.centroids.ptr<double>(i);
+		UevaMarker marker;
+		marker.area = stat[cv::CC_STAT_AREA];
+		marker.blob = cv::Rect_<int>(
+			stat[cv::CC_STAT_LEFT] + offset.x,
+			stat[cv::CC_STAT_TOP] + offset.y,
+			stat[cv::CC_STAT_WIDTH],
+			stat[cv::CC_STAT_HEIGHT]);
+		marker.centroid.x = c[0] + offset.x;
+		marker.centroid.y = c[1] + offset.y;
+		marker.rect = cv::Rect_<int>(
+			marker.centroid.x - settings.ctrlMarkerSize / 2,
+			marker.centroid.y - settings.ctrlMarkerSize / 2,
+			settings.ctrlMarkerSize,
+			settings.ctrlMarkerSize);
+		markers.push_back(marker);
+	}
+}
+
+void Ueva::morphLevels(const cv::Mat &src, cv::Mat &dst, const std::vector<uchar> &levels,
+	const cv::Size_<int> &erodeSize, const cv::Size_<int> &dilateSize, std::vector<UevaBitImage> &planes)
+{
+	// src only holds 0 and the given ascending levels, each level is one bit plane
+	// min and max filters commute with thresholding, so planes are filtered separately and stacked back
+	planes.resize(levels.size());
+	for (int i = 0; i < levels.size(); i++)
+	{
+		planes[i].fromMat(src, levels[i]);
+		if (erodeSize.area() > 1)
+		{
+			UevaBitImage::erode(planes[i], planes[i], erodeSize);
+		}
+		if (dilateSize.area() > 1)
+		{
+			UevaBitImage::dilate(planes[i], planes[i], dilateSize);
+		}
+	}
+	dst.create(src.size(), CV_8UC1);
+	dst.setTo(cv::Scalar_<int>(0));
+	for (int i = 0; i < levels.size(); i++)
+	{
+		planes[i].paintMat(dst, levels[i]);
+	}
+}
+
+static void subtractBkgdRow(const uchar *r, const uchar *b, const uchar *m, uchar *e, uchar *k,
+	int x, const int width, const uchar threshold)
+{
+	for (; x < width; x++)
+	{
+		uchar d = r[x] > b[x] ? r[x] - b[x] : b[x] - r[x];
+		uchar edge = d > threshold ? 255 : 0;
+		e[x] = edge;
+		k[x] = edge & m[x];
+	}
+}
+
+static int subtractBkgdRowSse2(const uchar *r, const uchar *b, const uchar *m, uchar *e, uchar *k,
+	const int width, const uchar threshold)
+{
+	const __m128i t = _mm_set1_epi8((char)threshold);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(-1);
+	int x = 0;
+	for (; x <= width - 16; x += 16)
+	{
+		__m128i vr = _mm_loadu_si128((const __m128i*)(r + x));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+		// |r - b| with saturation, then d > t exactly when d - t does not saturate to 0
+		__m128i d = _mm_or_si128(_mm_subs_epu8(vr, vb), _mm_subs_epu8(vb, vr));
+		__m128i notEdge = _mm_cmpeq_epi8(_mm_subs_epu8(d, t), zero);
+		_mm_storeu_si128((__m128i*)(e + x), _mm_andnot_si128(notEdge, ones));
+		_mm_storeu_si128((__m128i*)(k + x), _mm_andnot_si128(notEdge,
+			_mm_loadu_si128((const __m128i*)(m + x))));
+	}
+	return x;
+}
+
+#ifdef UEVA_AVX2
+UEVA_TARGET_AVX2 static int subtractBkgdRowAvx2(const uchar *r, const uchar *b, const uchar *m, uchar *e, uchar *k,
+	const int width, const uchar threshold)
+{
+	const __m256i t = _mm256_set1_epi8((char)threshold);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi8(-1);
+	int x = 0;
+	for (; x <= width - 32; x += 32)
+	{
+		__m256i vr = _mm256_loadu_si256((const __m256i*)(r + x));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + x));
+		__m256i d = _mm256_or_si256(_mm256_subs_epu8(vr, vb), _mm256_subs_epu8(vb, vr));
+		__m256i notEdge = _mm256_cmpeq_epi8(_mm256_subs_epu8(d, t), zero);
+		_mm256_storeu_si256((__m256i*)(e + x), _mm256_andnot_si256(notEdge, ones));
+		_mm256_storeu_si256((__m256i*)(k + x), _mm256_andnot_si256(notEdge,
+			_mm256_loadu_si256((const __m256i*)(m + x))));
+	}
+	_mm256_zeroupper();
+	return x;
+}
+#endif
+
+void Ueva::subtractBkgd(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const int threshold,
+	cv::Mat &edges, cv::Mat &markers)
+{
+	// same as absdiff, threshold and bitwise_and with marker mask, but one read of every input
+	CV_Assert(rawGray.type() == CV_8UC1 && bkgd.type() == CV_8UC1 && markerMask.type() == CV_8UC1);
+	CV_Assert(rawGray.size() == bkgd.size() && rawGray.size() == markerMask.size());
+	CV_Assert(threshold >= 0 && threshold <= 255);
+	edges.create(rawGray.size(), CV_8UC1);
+	markers.create(rawGray.size(), CV_8UC1);
+
+	bool useAvx2 = false;
+	bool useSse2 = cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSE2);
+#ifdef UEVA_AVX2
+	useAvx2 = cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_AVX2);
+#endif
+
+	for (int y = 0; y < rawGray.rows; y++)
+	{
+		const uchar *r = rawGray.ptr<uchar>(y);
+		const uchar *b = bkgd.ptr<uchar>(y);
+		const uchar *m = markerMask.ptr<uchar>(y);
+		uchar *e = edges.ptr<uchar>(y);
+		uchar *k = markers.ptr<uchar>(y);
+		int x = 0;
+#ifdef UEVA_AVX2
+		if (useAvx2)
+		{
+			x = subtractBkgdRowAvx2(r, b, m, e, k, rawGray.cols, (uchar)threshold);
+		}
+#endif
+		if (useSse2 && !useAvx2)
+		{
+			x = subtractBkgdRowSse2(r, b, m, e, k, rawGray.cols, (uchar)threshold);
+		}
+		subtractBkgdRow(r, b, m, e, k, x, rawGray.cols, (uchar)threshold);
+	}
+}
+
+// scanline fill, clears open pixels reachable from seeds in stack, never leaves rows top to bottom
+static void clearReachable(const cv::Mat &edges, cv::Mat &filled, const int top, const int bottom,
+	std::vector<cv::Point_<int>> &stack)
+{
+	const int width = edges.cols;
+	while (!stack.empty())
+	{
+		cv::Point_<int> p = stack.back();
+		stack.pop_back();
+		const uchar *e = edges.ptr<uchar>(p.y);
+		uchar *f = filled.ptr<uchar>(p.y);
+		if (e[p.x] || !f[p.x])
+		{
+			continue;
+		}
+		// clear whole span
+		int xl = p.x;
+		int xr = p.x;
+		while (xl > 0 && !e[xl - 1] && f[xl - 1])
+		{
+			xl--;
+		}
+		while (xr < width - 1 && !e[xr + 1] && f[xr + 1])
+		{
+			xr++;
+		}
+		memset(f + xl, 0, xr - xl + 1);
+		// one seed per run of open pixels above and below the span
+		for (int ny = p.y - 1; ny <= p.y + 1; ny += 2)
+		{
+			if (ny < top || ny >= bottom)
+			{
+				continue;
+			}
+			const uchar *ne = edges.ptr<uchar>(ny);
+			const uchar *nf = filled.ptr<uchar>(ny);
+			bool inRun = false;
+			for (int x = xl; x <= xr; x++)
+			{
+				bool open = !ne[x] && nf[x];
+				if (open && !inRun)
+				{
+					stack.push_back(cv::Point_<int>(x, ny));
+				}
+				inRun = open;
+			}
+		}
+	}
+}
+
+// seed row y wherever row across is cleared and y is still open, one seed per run
+static bool seedAcross(const cv::Mat &edges, const cv::Mat &filled, const int y, const int across,
+	std::vector<cv::Point_<int>> &stack)
+{
+	const uchar *e = edges.ptr<uchar>(y);
+	const uchar *f = filled.ptr<uchar>(y);
+	const uchar *af = filled.ptr<uchar>(across);
+	const uchar *ae = edges.ptr<uchar>(across);
+	bool seeded = false;
+	bool inRun = false;
+	for (int x = 0; x < edges.cols; x++)
+	{
+		bool open = !e[x] && f[x] && !ae[x] && !af[x];
+		if (open && !inRun)
+		{
+			stack.push_back(cv::Point_<int>(x, y));
+			seeded = true;
+		}
+		inRun = open;
+	}
+	return seeded;
+}
+
+class FillBandsBody : public cv::ParallelLoopBody
+{
+public:
+	FillBandsBody(const cv::Mat &e, cv::Mat &f, const std::vector<int> &b, std::vector<std::vector<cv::Point_<int>>> &s)
+		: edges(e), filled(f), bounds(b), stacks(s)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		for (int i = range.start; i < range.end; i++)
+		{
+			clearReachable(edges, filled, bounds[i], bounds[i + 1], stacks[i]);
+		}
+	}
+
+private:
+	const cv::Mat &edges;
+	cv::Mat &filled;
+	const std::vector<int> &bounds;
+	std::vector<std::vector<cv::Point_<int>>> &stacks;
+};
+
+void Ueva::fillHoles(const cv::Mat &edges, const cv::Mat &mask, cv::Mat &filled)
+{
+	// everything starts filled, background reachable from any border pixel is cleared by scanline fill,
+	// what remains is edges plus enclosed holes, then limited to mask
+	CV_Assert(edges.type() == CV_8UC1 && mask.type() == CV_8UC1 && edges.size() == mask.size());
+	filled.create(edges.size(), CV_8UC1);
+	filled.setTo(cv::Scalar_<int>(255));
+	const int width = edges.cols;
+	const int height = edges.rows;
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+
+	// row bands fill side by side, each only writes its own rows
+	const int MIN_BAND_ROWS = 64;
+	int numBands = std::max(1, std::min(cv::getNumThreads(), height / MIN_BAND_ROWS));
+	std::vector<int> bounds(numBands + 1);
+	for (int i = 0; i <= numBands; i++)
+	{
+		bounds[i] = height * i / numBands;
+	}
+
+	// seeds on all four borders, 4 connected like floodFill
+	std::vector<std::vector<cv::Point_<int>>> stacks(numBands);
+	for (int i = 0; i < numBands; i++)
+	{
+		std::vector<cv::Point_<int>> &stack = stacks[i];
+		stack.reserve(2 * (width + bounds[i + 1] - bounds[i]));
+		for (int x = 0; i == 0 && x < width; x++)
+		{
+			stack.push_back(cv::Point_<int>(x, 0));
+		}
+		for (int x = 0; i == numBands - 1 && x < width; x++)
 		{
-			iter = contours.erase(iter);
+			stack.push_back(cv::Point_<int>(x, height - 1));
+		}
+		for (int y = bounds[i]; y < bounds[i + 1]; y++)
+		{
+			stack.push_back(cv::Point_<int>(0, y));
+			stack.push_back(cv::Point_<int>(width - 1, y));
+		}
+	}
+
+	// background crossing a band border seeds the band across, until no band has new seeds
+	bool seeded = true;
+	while (seeded)
+	{
+		if (numBands == 1)
+		{
+			clearReachable(edges, filled, 0, height, stacks[0]);
 		}
 		else
 		{
-			iter++;
+			cv::parallel_for_(cv::Range(0, numBands), FillBandsBody(edges, filled, bounds, stacks), numBands);
+		}
+		seeded = false;
+		for (int i = 1; i < numBands; i++)
+		{
+			seeded = seedAcross(edges, filled, bounds[i] - 1, bounds[i], stacks[i - 1]) | seeded;
+			seeded = seedAcross(edges, filled, bounds[i], bounds[i] - 1, stacks[i]) | seeded;
 		}
 	}
+
+	cv::bitwise_and(filled, mask, filled);
 }
 
-void Ueva::trackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vector<UevaMarker> &oldMarkers, int trackTooFar)
+void Ueva::resetBkgdModel(UevaBkgdModel &model, const cv::Mat &bkgd, const std::vector<UevaChannel> &channels)
 {
-	// distance matrix (each row corresponds to a newMarker)
-	std::vector<std::vector<float>> l2NormMatrix;
-	for (int i = 0; i < newMarkers.size(); i++)
+	// only channel pixels are ever segmented, so only they are learnt, whole frame before channels exist
+	model.region = cv::Rect_<int>(cv::Point_<int>(0, 0), bkgd.size());
+	if (!channels.empty())
+	{
+		cv::Rect_<int> region = channels[0].rect;
+		for (int i = 1; i < channels.size(); i++)
+		{
+			region |= channels[i].rect;
+		}
+		model.region &= region;
+	}
+	bkgd(model.region).convertTo(model.mean, CV_32FC1);
+	model.variance.create(model.region.size(), CV_32FC1);
+	model.variance.setTo(cv::Scalar_<float>(UevaBkgdModel::initialVariance));
+	// two fixed buffers, outside region both stay equal to bkgd
+	model.front = bkgd.clone();
+	model.back = bkgd.clone();
+}
+
+static void updateBkgdModelRow(const uchar *r, const uchar *d, const uchar *k, float *mean, float *variance, uchar *b,
+	int x, const int width, const float rate)
+{
+	for (; x < width; x++)
+	{
+		float diff = r[x] - mean[x];
+		float sq = diff * diff;
+		// learn only background pixels that fit the model, so passing droplet edges are not absorbed
+		if (!(d[x] | k[x]) && sq < UevaBkgdModel::gateSquared * variance[x])
+		{
+			mean[x] += rate * diff;
+			variance[x] = std::max(variance[x] + rate * (sq - variance[x]), UevaBkgdModel::minVariance);
+		}
+		b[x] = cv::saturate_cast<uchar>(mean[x]);
+	}
+}
+
+static int updateBkgdModelRowSse2(const uchar *r, const uchar *d, const uchar *k, float *mean, float *variance, uchar *b,
+	const int width, const float rate)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 vRate = _mm_set1_ps(rate);
+	const __m128 vGate = _mm_set1_ps(UevaBkgdModel::gateSquared);
+	const __m128 vMin = _mm_set1_ps(UevaBkgdModel::minVariance);
+	int x = 0;
+	for (; x <= width - 4; x += 4)
+	{
+		// 4 pixels widened to float
+		int rawBytes;
+		int dropletBytes;
+		int markerBytes;
+		memcpy(&rawBytes, r + x, 4);
+		memcpy(&dropletBytes, d + x, 4);
+		memcpy(&markerBytes, k + x, 4);
+		__m128i raw16 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(rawBytes), zero);
+		__m128 vRaw = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw16, zero));
+		__m128i fg = _mm_cvtsi32_si128(dropletBytes | markerBytes);
+		fg = _mm_unpacklo_epi16(_mm_unpacklo_epi8(fg, zero), zero);
+		__m128 isBkgd = _mm_castsi128_ps(_mm_cmpeq_epi32(fg, zero));
+
+		__m128 vMean = _mm_loadu_ps(mean + x);
+		__m128 vVar = _mm_loadu_ps(variance + x);
+		__m128 diff = _mm_sub_ps(vRaw, vMean);
+		__m128 sq = _mm_mul_ps(diff, diff);
+		__m128 learn = _mm_and_ps(isBkgd, _mm_cmplt_ps(sq, _mm_mul_ps(vGate, vVar)));
+
+		__m128 newMean = _mm_add_ps(vMean, _mm_mul_ps(vRate, diff));
+		__m128 newVar = _mm_max_ps(_mm_add_ps(vVar, _mm_mul_ps(vRate, _mm_sub_ps(sq, vVar))), vMin);
+		vMean = _mm_or_ps(_mm_and_ps(learn, newMean), _mm_andnot_ps(learn, vMean));
+		vVar = _mm_or_ps(_mm_and_ps(learn, newVar), _mm_andnot_ps(learn, vVar));
+		_mm_storeu_ps(mean + x, vMean);
+		_mm_storeu_ps(variance + x, vVar);
+
+		// round and saturate back to 8 bit
+		__m128i mean32 = _mm_cvtps_epi32(vMean);
+		__m128i mean16 = _mm_packs_epi32(mean32, mean32);
+		int meanBytes = _mm_cvtsi128_si32(_mm_packus_epi16(mean16, mean16));
+		memcpy(b + x, &meanBytes, 4);
+	}
+	return x;
+}
+
+void Ueva::updateBkgdModel(UevaBkgdModel &model, const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers,
+	const float rate)
+{
+	// writes back only, caller makes sure no reader still holds it and swaps it to front when done
+	CV_Assert(model.back.size() == rawGray.size() && model.front.size() == rawGray.size());
+	CV_Assert(allDroplets.size() == rawGray.size() && allMarkers.size() == rawGray.size());
+	CV_Assert(model.mean.size() == model.region.size());
+	const cv::Rect_<int> &region = model.region;
+
+	bool useSse2 = cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSE2);
+	for (int y = 0; y < region.height; y++)
+	{
+		const uchar *r = rawGray.ptr<uchar>(region.y + y) + region.x;
+		const uchar *d = allDroplets.ptr<uchar>(region.y + y) + region.x;
+		const uchar *k = allMarkers.ptr<uchar>(region.y + y) + region.x;
+		float *mean = model.mean.ptr<float>(y);
+		float *variance = model.variance.ptr<float>(y);
+		uchar *b = model.back.ptr<uchar>(region.y + y) + region.x;
+		int x = 0;
+		if (useSse2)
+		{
+			x = updateBkgdModelRowSse2(r, d, k, mean, variance, b, region.width, rate);
+		}
+		updateBkgdModelRow(r, d, k, mean, variance, b, x, region.width, rate);
+	}
+}
+
+void Ueva::segmentImage(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const cv::Mat &dropletMask,
+	const UevaSettings &settings, const cv::Point_<int> &offset, cv::Mat &edges, UevaBitImage &bits, UevaBlobScratch &blobs,
+	cv::Mat &allMarkers, cv::Mat &allDroplets,
+	std::vector<UevaMarker> &markers, std::vector<std::vector< cv::Point_<int> >> &dropletContours,
+	qint64 *stageNs)
+{
+	QElapsedTimer timer;
+	timer.start();
+	// background subtraction to get edges, markers are edges inside marker mask
+	subtractBkgd(rawGray, bkgd, markerMask, settings.imgprogThreshold, edges, allMarkers);
+	qint64 subtracted = timer.nsecsElapsed();
+	// fill edges to get whole droplets, exclude noise with mask
+	fillHoles(edges, dropletMask, allDroplets);
+	// polish droplets with erosion for better kink detection
+	bits.fromMat(allDroplets);
+	UevaBitImage::erode(bits, bits, cv::Size_<int>(settings.imgprogErodeSize, settings.imgprogErodeSize));
+	bits.toMat(allDroplets);
+	qint64 filled = timer.nsecsElapsed();
+	// label markers, droplets need countours for shape analysis
+	extractMarkers(allMarkers, settings, offset, blobs, markers);
+	dropletContours.clear();
+	cv::findContours(allDroplets, dropletContours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE, offset);
+	// filter contours base on size	
+	bigPassFilter(dropletContours, settings.imgprogContourSize);
+	if (stageNs)
+	{
+		stageNs[UevaTile::SUBTRACT] = subtracted;
+		stageNs[UevaTile::FILL] = filled - subtracted;
+		stageNs[UevaTile::CONTOURS] = timer.nsecsElapsed() - filled;
+	}
+}
+
+static cv::Rect_<int> haloRect(const cv::Rect_<int> &core, const int halo, const cv::Rect_<int> &frame)
+{
+	return cv::Rect_<int>(core.x - halo, core.y - halo, core.width + 2 * halo, core.height + 2 * halo) & frame;
+}
+
+void Ueva::makeTiles(const std::vector<UevaChannel> &channels, const cv::Size_<int> &sz, const int halo, const bool perChannel,
+	std::vector<UevaTile> &tiles)
+{
+	// one tile per channel when no two channel rects come within two halos of each other,
+	// otherwise one tile around all channels, keep old tiles so their buffers are reused
+	cv::Rect_<int> frame = cv::Rect_<int>(0, 0, sz.width, sz.height);
+	bool separate = perChannel;
+	for (int i = 0; separate && i < channels.size(); i++)
+	{
+		cv::Rect_<int> a = haloRect(channels[i].rect, halo, frame);
+		for (int j = i + 1; separate && j < channels.size(); j++)
+		{
+			separate = (a & haloRect(channels[j].rect, halo, frame)).area() == 0;
+		}
+	}
+	tiles.resize(separate ? channels.size() : 1);
+	for (int i = 0; i < tiles.size(); i++)
+	{
+		tiles[i].core = separate ? channels[i].rect : channels[0].rect;
+	}
+	if (!separate)
 	{
-		std::vector<float> l2NormVector;
-		for (int j = 0; j < oldMarkers.size(); j++)
+		for (int i = 1; i < channels.size(); i++)
 		{
-			float l2Norm = sqrt(
-				pow(float(newMarkers[i].centroid.x - oldMarkers[j].centroid.x), 2) +
-				pow(float(newMarkers[i].centroid.y - oldMarkers[j].centroid.y), 2)
-				);
-			l2NormVector.push_back(l2Norm);
+			tiles[0].core |= channels[i].rect;
 		}
-		l2NormMatrix.push_back(l2NormVector);
 	}
-	// distance matrix transpose (each row corresponds to an oldMarker)
-	std::vector<std::vector<float>> l2NormMatrixT;
-	for (int j = 0; j < oldMarkers.size(); j++)
+	for (int i = 0; i < tiles.size(); i++)
 	{
-		std::vector<float> l2NormVectorT;
-		for (int i = 0; i < newMarkers.size(); i++)
+		tiles[i].rect = haloRect(tiles[i].core, halo, frame);
+	}
+}
+
+class SegmentTilesBody : public cv::ParallelLoopBody
+{
+public:
+	SegmentTilesBody(const cv::Mat &r, const cv::Mat &b, const cv::Mat &mm, const cv::Mat &dm,
+		const UevaSettings &s, std::vector<UevaTile> &t)
+		: rawGray(r), bkgd(b), markerMask(mm), dropletMask(dm), settings(s), tiles(t)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		for (int i = range.start; i < range.end; i++)
+		{
+			UevaTile &tile = tiles[i];
+			Ueva::segmentImage(rawGray(tile.rect), bkgd(tile.rect),
+				markerMask(tile.rect), dropletMask(tile.rect),
+				settings, tile.rect.tl(), tile.edges, tile.bits, tile.blobs, tile.allMarkers, tile.allDroplets,
+				tile.markers, tile.dropletContours, tile.stageNs);
+		}
+	}
+
+private:
+	const cv::Mat &rawGray;
+	const cv::Mat &bkgd;
+	const cv::Mat &markerMask;
+	const cv::Mat &dropletMask;
+	const UevaSettings &settings;
+	std::vector<UevaTile> &tiles;
+};
+
+void Ueva::segmentTiles(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const cv::Mat &dropletMask,
+	const UevaSettings &settings, std::vector<UevaTile> &tiles)
+{
+	// each tile only touches its own buffers, so tiles run on opencv worker pool
+	cv::parallel_for_(cv::Range(0, (int)tiles.size()),
+		SegmentTilesBody(rawGray, bkgd, markerMask, dropletMask, settings, tiles));
+}
+
+void Ueva::tileStageTimes(const std::vector<UevaTile> &tiles, qint64 *stageNs)
+{
+	// tiles run side by side, slowest tile is what the cycle waits for
+	for (int j = 0; j < UevaTile::NUM_STAGES; j++)
+	{
+		stageNs[j] = 0;
+		for (int i = 0; i < tiles.size(); i++)
+		{
+			stageNs[j] = std::max(stageNs[j], tiles[i].stageNs[j]);
+		}
+	}
+}
+
+void Ueva::mergeTiles(std::vector<UevaTile> &tiles, const cv::Size_<int> &sz, cv::Mat &allMarkers, cv::Mat &allDroplets,
+	std::vector<UevaMarker> &markers, std::vector<std::vector< cv::Point_<int> >> &dropletContours)
+{
+	allMarkers.create(sz, CV_8UC1);
+	allDroplets.create(sz, CV_8UC1);
+	allMarkers.setTo(cv::Scalar_<int>(0));
+	allDroplets.setTo(cv::Scalar_<int>(0));
+	markers.clear();
+	dropletContours.clear();
+	for (int i = 0; i < tiles.size(); i++)
+	{
+		// tiles never overlap, so every blob is seen by exactly one tile
+		tiles[i].allMarkers.copyTo(allMarkers(tiles[i].rect));
+		tiles[i].allDroplets.copyTo(allDroplets(tiles[i].rect));
+		markers.insert(markers.end(), tiles[i].markers.begin(), tiles[i].markers.end());
+		dropletContours.insert(dropletContours.end(), tiles[i].dropletContours.begin(), tiles[i].dropletContours.end());
+	}
+}
+
+// uniform grid of marker centroids, cell as big as track distance so only 3x3 cells need search
+struct MarkerGrid
+{
+	void build(const std::vector<UevaMarker> &m, const int cellSize)
+	{
+		markers = &m;
+		minX = minY = INT_MAX;
+		int maxX = INT_MIN;
+		int maxY = INT_MIN;
+		for (int i = 0; i < m.size(); i++)
+		{
+			minX = std::min(minX, m[i].centroid.x);
+			minY = std::min(minY, m[i].centroid.y);
+			maxX = std::max(maxX, m[i].centroid.x);
+			maxY = std::max(maxY, m[i].centroid.y);
+		}
+		// never smaller than track distance, grow so there are about as many cells as markers
+		double area = m.empty() ? 0.0 : double(maxX - minX + 1) * double(maxY - minY + 1);
+		cell = std::max(std::max(cellSize, 1), (int)std::ceil(std::sqrt(area / std::max((int)m.size(), 1))));
+		cols = m.empty() ? 0 : (maxX - minX) / cell + 1;
+		rows = m.empty() ? 0 : (maxY - minY) / cell + 1;
+		// counting sort, markers of cell c are order[start[c] .. start[c+1]), ascending index
+		start.assign(cols * rows + 1, 0);
+		for (int i = 0; i < m.size(); i++)
+		{
+			start[cellOf(m[i].centroid) + 1]++;
+		}
+		for (int c = 0; c < cols * rows; c++)
+		{
+			start[c + 1] += start[c];
+		}
+		order.resize(m.size());
+		fill.assign(start.begin(), start.end() - 1);
+		for (int i = 0; i < m.size(); i++)
 		{
-			float l2NormT = l2NormMatrix[i][j];
-			l2NormVectorT.push_back(l2NormT);
+			order[fill[cellOf(m[i].centroid)]++] = i;
 		}
-		l2NormMatrixT.push_back(l2NormVectorT);
 	}
-	// newMarker assiociates itself with oldMarker
-	std::vector<int> newOldIndices;
-	if (l2NormMatrixT.size() > 0)
+
+	int cellOf(const cv::Point_<int> &p) const
 	{
-		for (int i = 0; i < l2NormMatrix.size(); i++)
+		return ((p.y - minY) / cell) * cols + (p.x - minX) / cell;
+	}
+
+	// nearest marker within range, lowest index on ties like min_element, -1 if none
+	int nearest(const cv::Point_<int> &p, const int64 tooFarSquared, int64 &bestSquared) const
+	{
+		int best = -1;
+		bestSquared = tooFarSquared;
+		if (markers->empty())
+		{
+			return best;
+		}
+		int cx = (int)std::floor(double(p.x - minX) / cell);
+		int cy = (int)std::floor(double(p.y - minY) / cell);
+		for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, rows - 1); y++)
 		{
-			std::vector<float>::iterator iter = std::min_element(l2NormMatrix[i].begin(), l2NormMatrix[i].end());
-			if (*iter <= trackTooFar)
+			for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, cols - 1); x++)
 			{
-				newOldIndices.push_back(iter - l2NormMatrix[i].begin());
+				int c = y * cols + x;
+				for (int k = start[c]; k < start[c + 1]; k++)
+				{
+					int i = order[k];
+					int64 dx = (*markers)[i].centroid.x - p.x;
+					int64 dy = (*markers)[i].centroid.y - p.y;
+					int64 d = dx * dx + dy * dy;
+					if (d < bestSquared || (d == bestSquared && (best == -1 || i < best)))
+					{
+						bestSquared = d;
+						best = i;
+					}
+				}
 			}
-			else
+		}
+		return best;
+	}
+
+	const std::vector<UevaMarker> *markers;
+	int cell;
+	int minX;
+	int minY;
+	int cols;
+	int rows;
+	std::vector<int> start;
+	std::vector<int> order;
+	std::vector<int> fill;
+};
+
+// minimum cost perfect assignment of square cost matrix, row i gets column rowToCol[i]
+static void hungarian(const std::vector<int64> &cost, const int n, std::vector<int> &rowToCol)
+{
+	const int64 inf = std::numeric_limits<int64>::max() / 4;
+	std::vector<int64> u(n + 1, 0);
+	std::vector<int64> v(n + 1, 0);
+	std::vector<int> colToRow(n + 1, 0); // 1 based, 0 is free
+	std::vector<int> way(n + 1, 0);
+	std::vector<int64> minv(n + 1);
+	std::vector<char> used(n + 1);
+	for (int i = 1; i <= n; i++)
+	{
+		colToRow[0] = i;
+		int j0 = 0;
+		std::fill(minv.begin(), minv.end(), inf);
+		std::fill(used.begin(), used.end(), 0);
+		do
+		{
+			used[j0] = 1;
+			int i0 = colToRow[j0];
+			int64 delta = inf;
+			int j1 = 0;
+			for (int j = 1; j <= n; j++)
 			{
-				newOldIndices.push_back(-1);
+				if (!used[j])
+				{
+					int64 cur = cost[(i0 - 1) * n + (j - 1)] - u[i0] - v[j];
+					if (cur < minv[j])
+					{
+						minv[j] = cur;
+						way[j] = j0;
+					}
+					if (minv[j] < delta)
+					{
+						delta = minv[j];
+						j1 = j;
+					}
+				}
+			}
+			for (int j = 0; j <= n; j++)
+			{
+				if (used[j])
+				{
+					u[colToRow[j]] += delta;
+					v[j] -= delta;
+				}
+				else
+				{
+					minv[j] -= delta;
+				}
+			}
+			j0 = j1;
+		} while (colToRow[j0] != 0);
+		do
+		{
+			int j1 = way[j0];
+			colToRow[j0] = colToRow[j1];
+			j0 = j1;
+		} while (j0);
+	}
+	rowToCol.assign(n, -1);
+	for (int j = 1; j <= n; j++)
+	{
+		if (colToRow[j] != 0)
+		{
+			rowToCol[colToRow[j] - 1] = j - 1;
+		}
+	}
+}
+
+// markers left without round trip consensus but still in range of each other, solved globally per cluster
+static void assignAmbiguous(std::vector<UevaMarker> &newMarkers, const std::vector<UevaMarker> &oldMarkers,
+	const MarkerGrid &oldGrid, const std::vector<int> &oldTaken, const int64 tooFarSquared)
+{
+	// candidate edges between unmatched new and unmatched old markers
+	std::vector<std::vector<int>> newToOld(newMarkers.size());
+	std::vector<std::vector<int>> oldToNew(oldMarkers.size());
+	const int cell = oldGrid.cell;
+	for (int i = 0; i < newMarkers.size(); i++)
+	{
+		if (newMarkers[i].identity != -1 || oldMarkers.empty())
+		{
+			continue;
+		}
+		const cv::Point_<int> &p = newMarkers[i].centroid;
+		int cx = (int)std::floor(double(p.x - oldGrid.minX) / cell);
+		int cy = (int)std::floor(double(p.y - oldGrid.minY) / cell);
+		for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, oldGrid.rows - 1); y++)
+		{
+			for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, oldGrid.cols - 1); x++)
+			{
+				int c = y * oldGrid.cols + x;
+				for (int k = oldGrid.start[c]; k < oldGrid.start[c + 1]; k++)
+				{
+					int j = oldGrid.order[k];
+					int64 dx = oldMarkers[j].centroid.x - p.x;
+					int64 dy = oldMarkers[j].centroid.y - p.y;
+					if (!oldTaken[j] && dx * dx + dy * dy <= tooFarSquared)
+					{
+						newToOld[i].push_back(j);
+						oldToNew[j].push_back(i);
+					}
+				}
 			}
 		}
 	}
-	// oldMarker associates itself with newMarker
-	std::vector<int> oldNewIndices;
-	if (l2NormMatrix.size() > 0)
+
+	// connected clusters of candidates, each one small assignment problem
+	std::vector<char> newSeen(newMarkers.size(), 0);
+	std::vector<char> oldSeen(oldMarkers.size(), 0);
+	std::vector<int> clusterNew;
+	std::vector<int> clusterOld;
+	std::vector<int> stack;
+	std::vector<int64> cost;
+	std::vector<int> rowToCol;
+	for (int seed = 0; seed < newMarkers.size(); seed++)
 	{
-		for (int j = 0; j < l2NormMatrixT.size(); j++)
+		if (newSeen[seed] || newToOld[seed].empty())
+		{
+			continue;
+		}
+		clusterNew.clear();
+		clusterOld.clear();
+		newSeen[seed] = 1;
+		stack.push_back(seed); // new markers as i, old markers as -1 - j
+		while (!stack.empty())
 		{
-			std::vector<float>::iterator iter = std::min_element(l2NormMatrixT[j].begin(), l2NormMatrixT[j].end());
-			if (*iter <= trackTooFar)
+			int v = stack.back();
+			stack.pop_back();
+			if (v >= 0)
 			{
-				oldNewIndices.push_back(iter - l2NormMatrixT[j].begin());
+				clusterNew.push_back(v);
+				for (int k = 0; k < newToOld[v].size(); k++)
+				{
+					int j = newToOld[v][k];
+					if (!oldSeen[j])
+					{
+						oldSeen[j] = 1;
+						stack.push_back(-1 - j);
+					}
+				}
 			}
 			else
 			{
-				oldNewIndices.push_back(-1);
+				int j = -1 - v;
+				clusterOld.push_back(j);
+				for (int k = 0; k < oldToNew[j].size(); k++)
+				{
+					int i = oldToNew[j][k];
+					if (!newSeen[i])
+					{
+						newSeen[i] = 1;
+						stack.push_back(i);
+					}
+				}
+			}
+		}
+
+		// square matrix, out of range and padding cost more than any set of real pairs
+		// so most pairs are matched first, then total squared distance is smallest
+		int n = (int)std::max(clusterNew.size(), clusterOld.size());
+		const int64 forbidden = (tooFarSquared + 1) * (n + 1);
+		cost.assign(n * n, forbidden);
+		for (int a = 0; a < clusterNew.size(); a++)
+		{
+			for (int b = 0; b < clusterOld.size(); b++)
+			{
+				int64 dx = oldMarkers[clusterOld[b]].centroid.x - newMarkers[clusterNew[a]].centroid.x;
+				int64 dy = oldMarkers[clusterOld[b]].centroid.y - newMarkers[clusterNew[a]].centroid.y;
+				int64 d = dx * dx + dy * dy;
+				if (d <= tooFarSquared)
+				{
+					cost[a * n + b] = d;
+				}
+			}
+		}
+		hungarian(cost, n, rowToCol);
+		for (int a = 0; a < clusterNew.size(); a++)
+		{
+			int b = rowToCol[a];
+			if (b >= 0 && b < clusterOld.size() && cost[a * n + b] < forbidden)
+			{
+				newMarkers[clusterNew[a]].identity = oldMarkers[clusterOld[b]].identity;
+				newMarkers[clusterNew[a]].velocity = newMarkers[clusterNew[a]].centroid - oldMarkers[clusterOld[b]].centroid;
 			}
 		}
 	}
-	// round trip consensus
-	for (int i = 0; i < newOldIndices.size(); i++)
+}
+
+void Ueva::trackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vector<UevaMarker> &oldMarkers, int trackTooFar,
+	const bool optimal)
+{
+	const int64 tooFarSquared = (int64)trackTooFar * trackTooFar;
+	MarkerGrid oldGrid;
+	MarkerGrid newGrid;
+	oldGrid.build(oldMarkers, trackTooFar);
+	newGrid.build(newMarkers, trackTooFar);
+
+	// newMarker associates itself with nearest oldMarker, oldMarker with nearest newMarker,
+	// identity only passes on round trip consensus
+	std::vector<int> oldTaken(oldMarkers.size(), 0);
+	int64 d;
+	for (int i = 0; i < newMarkers.size(); i++)
 	{
-		int j = newOldIndices[i];
+		int j = oldGrid.nearest(newMarkers[i].centroid, tooFarSquared, d);
 		if (j > -1)
 		{
-			int iReturn = oldNewIndices[j];
+			int iReturn = newGrid.nearest(oldMarkers[j].centroid, tooFarSquared, d);
 			if (i == iReturn)
 			{
 				newMarkers[i].identity = oldMarkers[j].identity;
+				newMarkers[i].velocity = newMarkers[i].centroid - oldMarkers[j].centroid;
+				oldTaken[j] = 1;
 			}
 		}
 	}
+	// crowded markers without consensus, optional global assignment
+	if (optimal)
+	{
+		assignAmbiguous(newMarkers, oldMarkers, oldGrid, oldTaken, tooFarSquared);
+	}
 	// give identity to newly appeared markers
 	for (int i = 0; i < newMarkers.size(); i++)
 	{
@@ -183,27 +1013,202 @@ void Ueva::trackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vecto
 	}
 }
 
-int Ueva::detectKink(std::vector< cv::Point_<int>> &contour, const int convexSize)
+bool Ueva::trackMarkersInWindows(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask,
+	const UevaSettings &settings, const std::vector<UevaMarker> &oldMarkers, const std::vector<int> &followIndices,
+	cv::Mat &edges, cv::Mat &markers, UevaBlobScratch &blobs, std::vector<UevaMarker> &candidates,
+	std::vector<UevaMarker> &newMarkers)
+{
+	// look for each followed marker only around its predicted position, cost no longer depends on frame size
+	// false when any marker is not found cleanly, caller then falls back to full frame
+	newMarkers.clear();
+	const cv::Rect_<int> frame(0, 0, rawGray.cols, rawGray.rows);
+	const int64 tooFarSquared = (int64)settings.imgprogTrackTooFar * settings.imgprogTrackTooFar;
+	for (int i = 0; i < followIndices.size(); i++)
+	{
+		const UevaMarker &old = oldMarkers[followIndices[i]];
+		cv::Point_<int> predicted(
+			cvRound(old.centroid.x + old.velocity.x),
+			cvRound(old.centroid.y + old.velocity.y));
+		// marker size plus one more cycle of motion as slack for acceleration
+		int half = settings.ctrlMarkerSize +
+			(int)std::ceil(std::max(std::abs(old.velocity.x), std::abs(old.velocity.y)));
+		cv::Rect_<int> window = cv::Rect_<int>(predicted.x - half, predicted.y - half, 2 * half + 1, 2 * half + 1) & frame;
+		if (window.area() == 0)
+		{
+			return false;
+		}
+
+		subtractBkgd(rawGray(window), bkgd(window), markerMask(window), settings.imgprogThreshold, edges, markers);
+		extractMarkers(markers, settings, window.tl(), blobs, candidates);
+
+		int nearest = -1;
+		int64 nearestSquared = tooFarSquared;
+		for (int j = 0; j < candidates.size(); j++)
+		{
+			int64 dx = candidates[j].centroid.x - predicted.x;
+			int64 dy = candidates[j].centroid.y - predicted.y;
+			if (dx * dx + dy * dy <= nearestSquared)
+			{
+				nearest = j;
+				nearestSquared = dx * dx + dy * dy;
+			}
+		}
+		if (nearest == -1)
+		{
+			return false;
+		}
+		// marker cut by window edge has shifted centroid, unless edge is frame edge
+		UevaMarker &marker = candidates[nearest];
+		const cv::Rect_<int> &bound = marker.blob;
+		if ((bound.x == window.x && window.x != 0) ||
+			(bound.y == window.y && window.y != 0) ||
+			(bound.br().x == window.br().x && window.br().x != frame.width) ||
+			(bound.br().y == window.br().y && window.br().y != frame.height))
+		{
+			return false;
+		}
+		// overlapping windows must not claim same marker
+		for (int j = 0; j < newMarkers.size(); j++)
+		{
+			if (newMarkers[j].centroid == marker.centroid)
+			{
+				return false;
+			}
+		}
+
+		marker.identity = old.identity;
+		marker.velocity = marker.centroid - old.centroid;
+		newMarkers.push_back(marker);
+	}
+	return true;
+}
+
+void Ueva::simplifyContour(const std::vector< cv::Point_<int>> &contour, const double epsilon,
+	std::vector< cv::Point_<int>> &simplified, std::vector<int> &indices, std::vector<cv::Vec2i> &ranges)
+{
+	// douglas peucker on a closed contour, keeping the contour index of every kept point
+	simplified.clear();
+	indices.clear();
+	int n = (int)contour.size();
+	if (n < 4)
+	{
+		simplified = contour;
+		for (int i = 0; i < n; i++)
+		{
+			indices.push_back(i);
+		}
+		return;
+	}
+	// split closed contour at first point and the point farthest from it
+	int far = 0;
+	int64 farSquared = -1;
+	for (int i = 1; i < n; i++)
+	{
+		int64 dx = contour[i].x - contour[0].x;
+		int64 dy = contour[i].y - contour[0].y;
+		if (dx * dx + dy * dy > farSquared)
+		{
+			farSquared = dx * dx + dy * dy;
+			far = i;
+		}
+	}
+	// ranges end at n for the wrap back to first point, right half pushed first so indices come out ascending
+	ranges.clear();
+	ranges.push_back(cv::Vec2i(far, n));
+	ranges.push_back(cv::Vec2i(0, far));
+	const double epsilonSquared = epsilon * epsilon;
+	while (!ranges.empty())
+	{
+		int a = ranges.back()[0];
+		int b = ranges.back()[1];
+		ranges.pop_back();
+		const cv::Point_<int> &pa = contour[a];
+		const cv::Point_<int> &pb = contour[b % n];
+		double dx0 = pb.x - pa.x;
+		double dy0 = pb.y - pa.y;
+		double lengthSquared = dx0 * dx0 + dy0 * dy0;
+		int split = -1;
+		double splitMeasure = 0;
+		for (int i = a + 1; i < b; i++)
+		{
+			double dx = contour[i].x - pa.x;
+			double dy = contour[i].y - pa.y;
+			// squared distance to chord times chord length squared, plain squared distance for closed chord
+			double measure = lengthSquared > 0 ? (dx0 * dy - dy0 * dx) * (dx0 * dy - dy0 * dx) : dx * dx + dy * dy;
+			if (measure > splitMeasure)
+			{
+				splitMeasure = measure;
+				split = i;
+			}
+		}
+		if (split != -1 && splitMeasure > epsilonSquared * std::max(lengthSquared, 1.0))
+		{
+			ranges.push_back(cv::Vec2i(split, b));
+			ranges.push_back(cv::Vec2i(a, split));
+		}
+		else
+		{
+			simplified.push_back(pa);
+			indices.push_back(a);
+		}
+	}
+}
+
+int Ueva::detectKink(std::vector< cv::Point_<int>> &contour, const int convexSize, UevaShapeScratch &scratch)
 {
-	std::vector<int> hull;
-	cv::convexHull(contour, hull);
+	// hull and defects on simplified contour, every defect then refined on the full contour
+	// so kink index and depth are full resolution, only hull vertices may be off by epsilon
+	const double epsilon = 1.0;
+	std::vector< cv::Point_<int>> &simplified = scratch.simplified;
+	std::vector<int> &indices = scratch.indices;
+	simplifyContour(contour, epsilon, simplified, indices, scratch.ranges);
 
-	std::vector<cv::Vec4i> defects;
-	cv::convexityDefects(contour, hull, defects);
+	std::vector<int> &hull = scratch.hull;
+	cv::convexHull(simplified, hull);
+
+	std::vector<cv::Vec4i> &defects = scratch.defects;
+	cv::convexityDefects(simplified, hull, defects);
 
 	int kinkIndex = -1;
 	int depth = 0;
 	for (int i = 0; i < defects.size(); i++)
 	{
-		if (defects[i][2] > defects[i][0] && defects[i][2] < defects[i][1]) // filter opencv bug
+		// deepest full contour point between the two hull vertices, same fixed point depth as opencv
+		// defect across contour start is dropped like before, simplified contour keeps index 0 so it is the same defect
+		int start = indices[defects[i][0]];
+		int end = indices[defects[i][1]];
+		if (end <= start) // filter opencv bug
+		{
+			continue;
+		}
+		int span = end - start;
+		double dx0 = contour[end].x - contour[start].x;
+		double dy0 = contour[end].y - contour[start].y;
+		if (dx0 == 0 && dy0 == 0)
 		{
-			if (defects[i][3] > convexSize * 256) // filter small defects
+			continue;
+		}
+		double scale = 1.0 / std::sqrt(dx0 * dx0 + dy0 * dy0);
+		int farIndex = -1;
+		double farDistance = 0;
+		for (int k = 1; k < span; k++)
+		{
+			int j = start + k;
+			double distance = std::abs(dx0 * (contour[j].y - contour[start].y) -
+				dy0 * (contour[j].x - contour[start].x)) * scale;
+			if (distance > farDistance)
 			{
-				if (defects[i][3] > depth) // get deepest defect
-				{
-					depth = defects[i][3];
-					kinkIndex = defects[i][2];
-				}
+				farDistance = distance;
+				farIndex = j;
+			}
+		}
+		int farDepth = cvRound(farDistance * 256);
+		if (farIndex != -1 && farDepth > convexSize * 256) // filter small defects
+		{
+			if (farDepth > depth) // get deepest defect
+			{
+				depth = farDepth;
+				kinkIndex = farIndex;
 			}
 		}
 	}
@@ -211,87 +1216,232 @@ int Ueva::detectKink(std::vector< cv::Point_<int>> &contour, const int convexSiz
 	return kinkIndex;
 }
 
-int Ueva::detectNeck(std::vector< cv::Point_<int>> &contour, int &kinkIndex, float &neckDistance, const int threshold)
+static void distanceProfile(const cv::Point_<int> *points, const int n, const cv::Point_<int> &origin, float *profile)
+{
+	int i = 0;
+	if (cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSE2))
+	{
+		const __m128i o = _mm_set_epi32(origin.y, origin.x, origin.y, origin.x);
+		for (; i <= n - 4; i += 4)
+		{
+			// two points per register as x y x y, deinterleave after squaring
+			__m128 a = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_loadu_si128((const __m128i*)(points + i)), o));
+			__m128 b = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_loadu_si128((const __m128i*)(points + i + 2)), o));
+			a = _mm_mul_ps(a, a);
+			b = _mm_mul_ps(b, b);
+			__m128 d = _mm_add_ps(
+				_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+				_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+			_mm_storeu_ps(profile + i, _mm_sqrt_ps(d));
+		}
+	}
+	for (; i < n; i++)
+	{
+		float dx = float(points[i].x - origin.x);
+		float dy = float(points[i].y - origin.y);
+		profile[i] = std::sqrt(dx * dx + dy * dy);
+	}
+}
+
+// strict total order on profile samples, equal values ordered by index like p1d
+static inline bool isLower(const float *v, const int a, const int b)
+{
+	return v[a] < v[b] || (v[a] == v[b] && a < b);
+}
+
+// for every sample, lowest sample between it and the nearest higher sample on one side, -1 if none
+static void lowestBeforeHigher(const float *v, const int n, const int step, std::vector<int> &stack, int *lowest)
 {
-	std::vector<float> profile;
-	for (int i = kinkIndex; i < contour.size(); i++)
+	stack.clear();
+	int begin = step > 0 ? 0 : n - 1;
+	for (int k = 0, i = begin; k < n; k++, i += step)
 	{
-		float l2Norm = sqrt(
-			pow(float(contour[i].x - contour[kinkIndex].x), 2) +
-			pow(float(contour[i].y - contour[kinkIndex].y), 2)
-			);
-		profile.push_back(l2Norm);
-		if (UevaDroplet::fileStream.is_open())
+		int running = -1;
+		while (!stack.empty() && isLower(v, stack.back(), i))
 		{
-			UevaDroplet::fileStream << l2Norm << ",";
+			int top = stack.back();
+			if (running == -1 || isLower(v, top, running))
+			{
+				running = top;
+			}
+			if (lowest[top] != -1 && isLower(v, lowest[top], running))
+			{
+				running = lowest[top];
+			}
+			stack.pop_back();
 		}
+		lowest[i] = running;
+		stack.push_back(i);
+	}
+}
+
+static void pairPersistence(const std::vector<float> &profile, const float threshold, UevaShapeScratch &scratch)
+{
+	// same pairs as p1d::Persistence1D with persistence at least threshold, in order of maximum index
+	// elder rule: each interior maximum kills the younger of the lowest minima on its two sides
+	// found with two monotonic stack passes instead of sorting every sample
+	std::vector<p1d::TPairedExtrema> &extremas = scratch.extremas;
+	extremas.clear();
+	int n = (int)profile.size();
+	if (n < 3)
+	{
+		return;
 	}
-	for (int i = 0; i < kinkIndex; i++)
+	const float *v = &profile[0];
+	scratch.leftLowest.resize(n);
+	scratch.rightLowest.resize(n);
+	lowestBeforeHigher(v, n, 1, scratch.stack, &scratch.leftLowest[0]);
+	lowestBeforeHigher(v, n, -1, scratch.stack, &scratch.rightLowest[0]);
+	for (int i = 1; i < n - 1; i++)
 	{
-		float l2Norm = sqrt(
-			pow(float(contour[i].x - contour[kinkIndex].x), 2) +
-			pow(float(contour[i].y - contour[kinkIndex].y), 2)
-			);
-		profile.push_back(l2Norm);
-		if (UevaDroplet::fileStream.is_open())
+		if (isLower(v, i - 1, i) && isLower(v, i + 1, i))
 		{
-			UevaDroplet::fileStream << l2Norm << ",";
+			int left = scratch.leftLowest[i];
+			int right = scratch.rightLowest[i];
+			p1d::TPairedExtrema pair;
+			pair.MaxIndex = i;
+			pair.MinIndex = isLower(v, left, right) ? right : left;
+			pair.Persistence = v[i] - v[pair.MinIndex];
+			if (pair.Persistence >= threshold)
+			{
+				extremas.push_back(pair);
+			}
 		}
 	}
+}
 
-	p1d::Persistence1D persistence;
-	persistence.RunPersistence(profile);
+int Ueva::detectNeck(std::vector< cv::Point_<int>> &contour, int &kinkIndex, float &neckDistance, const int threshold,
+	UevaShapeScratch &scratch)
+{
+	// distance from kink along contour starting at kink, so profile starts at its global minimum
+	int n = (int)contour.size();
+	std::vector<float> &profile = scratch.profile;
+	profile.resize(n);
+	distanceProfile(&contour[kinkIndex], n - kinkIndex, contour[kinkIndex], &profile[0]);
+	distanceProfile(&contour[0], kinkIndex, contour[kinkIndex], &profile[n - kinkIndex]);
+	if (UevaDroplet::fileStream.is_open())
+	{
+		scratch.logged.insert(scratch.logged.end(), profile.begin(), profile.end());
+	}
 
-	std::vector< p1d::TPairedExtrema > extremas;
-	persistence.GetPairedExtrema(extremas, float(threshold));
+	pairPersistence(profile, float(threshold), scratch);
+	std::vector< p1d::TPairedExtrema > &extremas = scratch.extremas;
 
-	std::vector<int> indices;
 	int neckIndex = -1;
 	neckDistance = 0.0;
 	if (extremas.size() == 2) // 2 maxima droplet is healthy, 1st minima is neck
 	{
-		sort(extremas.begin(), extremas.end(),
-			[](const p1d::TPairedExtrema &a, const p1d::TPairedExtrema &b)
-		{
-			return a.MinIndex < b.MinIndex;
-		});
-		for (int i = 0; i < extremas.size(); i++)
+		int first = extremas[0].MinIndex < extremas[1].MinIndex ? 0 : 1;
+		neckIndex = extremas[first].MinIndex;
+		neckDistance = profile[extremas[first].MinIndex];
+	}
+	else if (extremas.size() >= 3)  // 3 or more maxima droplet is overgrown, 2nd maxima is neck
+	{
+		neckIndex = extremas[1].MaxIndex;
+		neckDistance = profile[extremas[1].MaxIndex];
+	}
+	// profile index back to contour index
+	if (neckIndex != -1)
+	{
+		neckIndex = neckIndex < n - kinkIndex ? kinkIndex + neckIndex : neckIndex - (n - kinkIndex);
+	}
+
+	return neckIndex;
+}
+
+class AnalyseDropletsBody : public cv::ParallelLoopBody
+{
+public:
+	AnalyseDropletsBody(std::vector<std::vector< cv::Point_<int> >> &c, const UevaSettings &s,
+		std::vector<UevaDroplet> &d, std::vector<UevaShapeScratch> &sc, int n)
+		: contours(c), settings(s), droplets(d), scratches(sc), numStripes(n)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		// one stripe per scratch, droplets split evenly between stripes
+		for (int k = range.start; k < range.end; k++)
 		{
-			if (extremas[i].MinIndex < (contour.size() - kinkIndex))
-			{
-				indices.push_back(kinkIndex + extremas[i].MinIndex);
-			}
-			else
+			int begin = (int)contours.size() * k / numStripes;
+			int end = (int)contours.size() * (k + 1) / numStripes;
+			for (int i = begin; i < end; i++)
 			{
-				indices.push_back(extremas[i].MinIndex - (contour.size() - kinkIndex));
+				Ueva::analyseDroplet(contours[i], settings, droplets[i], scratches[k]);
 			}
 		}
-		neckIndex = indices[0];
-		neckDistance = profile[extremas[0].MinIndex];
 	}
-	else if (extremas.size() >= 3)  // 3 or more maxima droplet is overgrown, 2nd maxima is neck
+
+private:
+	std::vector<std::vector< cv::Point_<int> >> &contours;
+	const UevaSettings &settings;
+	std::vector<UevaDroplet> &droplets;
+	std::vector<UevaShapeScratch> &scratches;
+	int numStripes;
+};
+
+void Ueva::analyseDroplet(std::vector< cv::Point_<int>> &contour, const UevaSettings &settings, UevaDroplet &droplet,
+	UevaShapeScratch &scratch)
+{
+	droplet.kinkIndex = Ueva::detectKink(contour, settings.imgprocConvexSize, scratch);
+	if (droplet.kinkIndex != -1)
+	{
+		droplet.neckIndex = Ueva::detectNeck(contour,
+			droplet.kinkIndex,
+			droplet.neckDistance,
+			settings.imgprocPersistence,
+			scratch);
+	}
+}
+
+void Ueva::analyseDroplets(std::vector<std::vector< cv::Point_<int> >> &contours, const UevaSettings &settings,
+	std::vector<UevaDroplet> &droplets, std::vector<UevaShapeScratch> &scratches)
+{
+	droplets.assign(contours.size(), UevaDroplet());
+	// stripes below this many contour points are done serially, kink and neck cost about 30 ns per point
+	// on one thread (3900 points in 114 us) so a smaller stripe finishes before parallel_for_ wakes a worker
+	const int STRIPE_MIN_POINTS = 2000;
+	int numPoints = 0;
+	for (int i = 0; i < contours.size(); i++)
+	{
+		numPoints += (int)contours[i].size();
+	}
+	int numStripes = std::max(1, std::min(std::min(cv::getNumThreads(), (int)contours.size()),
+		numPoints / STRIPE_MIN_POINTS));
+	if (scratches.size() < numStripes)
+	{
+		scratches.resize(numStripes);
+	}
+	for (int k = 0; k < numStripes; k++)
+	{
+		scratches[k].logged.clear();
+	}
+
+	if (numStripes == 1)
 	{
-		sort(extremas.begin(), extremas.end(),
-			[](const p1d::TPairedExtrema &a, const p1d::TPairedExtrema &b)
+		for (int i = 0; i < contours.size(); i++)
 		{
-			return a.MaxIndex < b.MaxIndex;
-		});
-		for (int i = 0; i < extremas.size(); i++)
+			Ueva::analyseDroplet(contours[i], settings, droplets[i], scratches[0]);
+		}
+	}
+	else
+	{
+		// stripes never share scratch, so persistent buffers are reused without locking
+		cv::parallel_for_(cv::Range(0, numStripes),
+			AnalyseDropletsBody(contours, settings, droplets, scratches, numStripes), numStripes);
+	}
+
+	// stripes hold consecutive droplets, so neck profile log keeps droplet order
+	if (UevaDroplet::fileStream.is_open())
+	{
+		for (int k = 0; k < numStripes; k++)
 		{
-			if (extremas[i].MaxIndex < (contour.size() - kinkIndex))
+			for (int i = 0; i < scratches[k].logged.size(); i++)
 			{
-				indices.push_back(kinkIndex + extremas[i].MaxIndex);
-			}
-			else
-			{
-				indices.push_back(extremas[1].MaxIndex - (contour.size() - kinkIndex));
+				UevaDroplet::fileStream << scratches[k].logged[i] << ",";
 			}
 		}
-		neckIndex = indices[1];
-		neckDistance = profile[extremas[1].MaxIndex];
 	}
-
-	return neckIndex;
 }
 
 int Ueva::masksOverlap(cv::Mat &mask1, cv::Mat &mask2)
@@ -301,54 +1451,149 @@ int Ueva::masksOverlap(cv::Mat &mask1, cv::Mat &mask2)
 	return cv::countNonZero(mask3);
 }
 
-bool Ueva::isMarkerInChannel(UevaMarker &marker, UevaChannel &channel, int xMargin, int yMargin)
+void Ueva::dropletsToChannels(const std::vector<std::vector< cv::Point_<int> >> &contours, const cv::Mat &allDroplets,
+	const cv::Mat &channelMap, cv::Mat &labels, std::vector<UevaChannel> &channels)
 {
-	// channel is vertical
-	if (channel.direction <= 1)
+	// one labeling for all droplets, labels buffer is reused between cycles
+	int numLabels = cv::connectedComponents(allDroplets, labels, 8, CV_32S);
+
+	// external contour starts on its own blob, so first point gives the label
+	std::vector<int> dropletLabels(contours.size(), 0);
+	for (int j = 0; j < contours.size(); j++)
+	{
+		dropletLabels[j] = labels.at<int>(contours[j][0]);
+	}
+
+	// label histogram of every channel in one pass over the frame
+	std::vector<int> histogram(channels.size() * numLabels, 0);
+	for (int y = 0; y < labels.rows; y++)
 	{
-		if (marker.centroid.y > (channel.rect.y + yMargin) &&
-			marker.centroid.y < (channel.rect.y + channel.rect.height - yMargin))
+		const int *l = labels.ptr<int>(y);
+		const uchar *c = channelMap.ptr<uchar>(y);
+		for (int x = 0; x < labels.cols; x++)
 		{
-			uchar*p = channel.mask.ptr<uchar>(marker.centroid.y);
-			if (p[marker.centroid.x] > 0)
+			if (c[x] && l[x])
 			{
-				return true;
+				histogram[(c[x] - 1) * numLabels + l[x]]++;
 			}
 		}
 	}
-	// channel is horizontal
-	if (channel.direction >= 2)
+
+	// same tie breaking as pairwise overlap, first droplet with most pixels wins
+	for (int i = 0; i < channels.size(); i++)
 	{
-		if (marker.centroid.x >(channel.rect.x + xMargin) &&
-			marker.centroid.x < (channel.rect.x + channel.rect.width - xMargin))
+		const int *h = &histogram[channels[i].index * numLabels];
+		channels[i].biggestDropletIndex = -1;
+		int maxOverlap = 0;
+		for (int j = 0; j < contours.size(); j++)
 		{
-			uchar*p = channel.mask.ptr<uchar>(marker.centroid.y);
-			if (p[marker.centroid.x] > 0)
+			int overlap = h[dropletLabels[j]];
+			if (dropletLabels[j] > 0 && overlap > maxOverlap)
 			{
-				return true;
+				maxOverlap = overlap;
+				channels[i].biggestDropletIndex = j;
 			}
 		}
 	}
+}
 
-	return false;
+bool Ueva::isMarkerInChannel(UevaMarker &marker, UevaChannel &channel, const cv::Mat &channelMap, int xMargin, int yMargin)
+{
+	// channel is vertical
+	if (channel.direction <= 1)
+	{
+		if (marker.centroid.y <= (channel.rect.y + yMargin) ||
+			marker.centroid.y >= (channel.rect.y + channel.rect.height - yMargin))
+		{
+			return false;
+		}
+	}
+	// channel is horizontal
+	if (channel.direction >= 2)
+	{
+		if (marker.centroid.x <= (channel.rect.x + xMargin) ||
+			marker.centroid.x >= (channel.rect.x + channel.rect.width - xMargin))
+		{
+			return false;
+		}
+	}
+
+	return markerToChannel(marker, channelMap) == channel.index;
 }
 
-bool Ueva::isCombinationPossible(std::vector<int> &combination, std::vector<UevaCtrl> &ctrls)
+void Ueva::indexCtrls(const std::vector<UevaCtrl> &ctrls, UevaCtrlLookup &lookup)
 {
-	std::sort(combination.begin(), combination.end());
+	lookup.clear();
 	for (int i = 0; i < ctrls.size(); i++)
 	{
-		std::vector<int> ctrlOutputIdx;
+		if (ctrls[i].uncoUnob != 0)
+		{
+			continue;
+		}
+		// only ascending output indices can equal a sorted combination
+		uint64 mask = 0;
+		int previous = -1;
+		bool isAscending = true;
 		for (int j = 0; j < ctrls[i].outputIndices.cols; j++)
 		{
-			ctrlOutputIdx.push_back(ctrls[i].outputIndices.at<uchar>(j));
+			int index = ctrls[i].outputIndices.at<uchar>(j);
+			CV_Assert(index < 64);
+			if (index <= previous)
+			{
+				isAscending = false;
+				break;
+			}
+			mask |= (uint64)1 << index;
+			previous = index;
+		}
+		if (isAscending)
+		{
+			lookup.insert(std::make_pair(mask, i)); // first controller wins
+		}
+	}
+}
+
+bool Ueva::isCombinationPossible(std::vector<int> &combination, const UevaCtrlLookup &lookup)
+{
+	std::sort(combination.begin(), combination.end());
+	uint64 mask = 0;
+	for (int i = 0; i < combination.size(); i++)
+	{
+		if (combination[i] < 0 || combination[i] >= 64 ||
+			(i > 0 && combination[i] == combination[i - 1]))
+		{
+			return false;
 		}
-		if (combination == ctrlOutputIdx &&	ctrls[i].uncoUnob == 0)
+		mask |= (uint64)1 << combination[i];
+	}
+	UevaCtrlLookup::const_iterator found = lookup.find(mask);
+	if (found == lookup.end())
+	{
+		return false;
+	}
+	UevaCtrl::index = found->second;
+	return true;
+}
+
+bool Ueva::isCombinationPossible(std::vector<int> &combination, std::vector<UevaCtrl> &ctrls,
+	UevaCtrlLookup &lookup, UevaCtrlCache &cache)
+{
+	cache.collect(ctrls, lookup);
+	if (isCombinationPossible(combination, lookup))
+	{
+		cache.touch(UevaCtrl::index);
+		// losing any one channel should find its controller already designed
+		std::vector<int> subset;
+		for (int i = 0; combination.size() > 1 && i < combination.size(); i++)
 		{
-			UevaCtrl::index = i;
-			return true;
+			subset = combination;
+			subset.erase(subset.begin() + i);
+			cache.request(subset, lookup);
 		}
+		return true;
 	}
+	// designed on designer thread, possible once a later call collects it
+	cache.request(combination, lookup);
 	return false;
 }
 
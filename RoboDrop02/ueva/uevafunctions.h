@@ -26,12 +26,28 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 #include "opencv2/imgproc.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include <QtGui >
+#include <QElapsedTimer >
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <cmath>
+#include <climits>
+#include <limits>
+#include <cstring>
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__GNUC__)
+#include <immintrin.h>
+#define UEVA_AVX2 // avx2 intrinsics always compiled, use is decided at runtime
+#endif
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define UEVA_TARGET_AVX2 __attribute__((target("avx2"))) // gcc and clang only emit avx2 in functions asking for it
+#else
+#define UEVA_TARGET_AVX2
+#endif
 #include "persistence1d.hpp"
 
 #include "uevastructures.h"
+#include "uevactrldesign.h"
 
 namespace Ueva
 {
@@ -41,21 +57,86 @@ namespace Ueva
 
 	cv::Mat contour2Mask(const std::vector<cv::Point_<int>> &contour, const cv::Size_<int> &sz);
 
-	std::vector<cv::Point_<int>> mask2Contour(const cv::Mat &mask);
+	cv::Mat contour2Mask(const std::vector<cv::Point_<int>> &contour, const cv::Rect_<int> &roi);
+
+	std::vector<cv::Point_<int>> mask2Contour(const cv::Mat &mask, const cv::Point_<int> &offset = cv::Point_<int>());
+
+	cv::Mat channels2Map(const std::vector<UevaChannel> &channels, const cv::Size_<int> &sz);
+
+	int markerToChannel(const UevaMarker &marker, const cv::Mat &channelMap);
 
 	void bigPassFilter(std::vector<std::vector< cv::Point_<int> >> &contours, const int size);
 
-	void trackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vector<UevaMarker> &oldMarkers, int trackTooFar);
+	void extractMarkers(const cv::Mat &allMarkers, const UevaSettings &settings, const cv::Point_<int> &offset,
+		UevaBlobScratch &blobs, std::vector<UevaMarker> &markers);
+
+	void morphLevels(const cv::Mat &src, cv::Mat &dst, const std::vector<uchar> &levels,
+		const cv::Size_<int> &erodeSize, const cv::Size_<int> &dilateSize, std::vector<UevaBitImage> &planes);
+
+	void subtractBkgd(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const int threshold,
+		cv::Mat &edges, cv::Mat &markers);
+
+	void fillHoles(const cv::Mat &edges, const cv::Mat &mask, cv::Mat &filled);
+
+	void resetBkgdModel(UevaBkgdModel &model, const cv::Mat &bkgd, const std::vector<UevaChannel> &channels);
+
+	void updateBkgdModel(UevaBkgdModel &model, const cv::Mat &rawGray, const cv::Mat &allDroplets, const cv::Mat &allMarkers,
+		const float rate);
+
+	void segmentImage(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const cv::Mat &dropletMask,
+		const UevaSettings &settings, const cv::Point_<int> &offset, cv::Mat &edges, UevaBitImage &bits, UevaBlobScratch &blobs,
+		cv::Mat &allMarkers, cv::Mat &allDroplets,
+		std::vector<UevaMarker> &markers, std::vector<std::vector< cv::Point_<int> >> &dropletContours,
+		qint64 *stageNs = 0);
+
+	void makeTiles(const std::vector<UevaChannel> &channels, const cv::Size_<int> &sz, const int halo, const bool perChannel,
+		std::vector<UevaTile> &tiles);
+
+	void segmentTiles(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask, const cv::Mat &dropletMask,
+		const UevaSettings &settings, std::vector<UevaTile> &tiles);
 
-	int detectKink(std::vector< cv::Point_<int>> &contour, const int convexSize);
+	void tileStageTimes(const std::vector<UevaTile> &tiles, qint64 *stageNs);
 
-	int detectNeck(std::vector< cv::Point_<int>> &contour, int &kinkIndex, float &neck, const int threshold);
+	void mergeTiles(std::vector<UevaTile> &tiles, const cv::Size_<int> &sz, cv::Mat &allMarkers, cv::Mat &allDroplets,
+		std::vector<UevaMarker> &markers, std::vector<std::vector< cv::Point_<int> >> &dropletContours);
+
+	void trackMarkerIdentities(std::vector<UevaMarker> &newMarkers, std::vector<UevaMarker> &oldMarkers, int trackTooFar,
+		const bool optimal = false);
+
+	bool trackMarkersInWindows(const cv::Mat &rawGray, const cv::Mat &bkgd, const cv::Mat &markerMask,
+		const UevaSettings &settings, const std::vector<UevaMarker> &oldMarkers, const std::vector<int> &followIndices,
+		cv::Mat &edges, cv::Mat &markers, UevaBlobScratch &blobs, std::vector<UevaMarker> &candidates,
+		std::vector<UevaMarker> &newMarkers);
+
+	void simplifyContour(const std::vector< cv::Point_<int>> &contour, const double epsilon,
+		std::vector< cv::Point_<int>> &simplified, std::vector<int> &indices, std::vector<cv::Vec2i> &ranges);
+
+	int detectKink(std::vector< cv::Point_<int>> &contour, const int convexSize, UevaShapeScratch &scratch);
+
+	int detectNeck(std::vector< cv::Point_<int>> &contour, int &kinkIndex, float &neck, const int threshold,
+		UevaShapeScratch &scratch);
+
+	void analyseDroplet(std::vector< cv::Point_<int>> &contour, const UevaSettings &settings, UevaDroplet &droplet,
+		UevaShapeScratch &scratch);
+
+	void analyseDroplets(std::vector<std::vector< cv::Point_<int> >> &contours, const UevaSettings &settings,
+		std::vector<UevaDroplet> &droplets, std::vector<UevaShapeScratch> &scratches);
 
 	int masksOverlap(cv::Mat &mask1, cv::Mat &mask2);
 
-	bool isMarkerInChannel(UevaMarker &marker, UevaChannel &channel, int xMargin, int yMargin);
+	void dropletsToChannels(const std::vector<std::vector< cv::Point_<int> >> &contours, const cv::Mat &allDroplets,
+		const cv::Mat &channelMap, cv::Mat &labels, std::vector<UevaChannel> &channels);
+
+	bool isMarkerInChannel(UevaMarker &marker, UevaChannel &channel, const cv::Mat &channelMap, int xMargin, int yMargin);
+
+	void indexCtrls(const std::vector<UevaCtrl> &ctrls, UevaCtrlLookup &lookup);
+
+	bool isCombinationPossible(std::vector<int> &combination, const UevaCtrlLookup &lookup);
 
-	bool isCombinationPossible(std::vector<int> &combination, std::vector<UevaCtrl> &ctrls);
+	// queues design from plant when lookup has none and reports not possible until it is collected
+	// cache inactive behaves as above
+	bool isCombinationPossible(std::vector<int> &combination, std::vector<UevaCtrl> &ctrls,
+		UevaCtrlLookup &lookup, UevaCtrlCache &cache);
 
 	void deleteFromCombination(std::vector<int> &combination, const int value);
 
@@ -0,0 +1,187 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "uevaprofiler.h"
+
+const char *UevaProfiler::stageNames[NUM_STAGES] =
+{
+	"mask",
+	"absdiff",
+	"fill",
+	"contours",
+	"bkgd",
+	"tracking",
+	"kinkNeck",
+	"input",
+	"design",
+	"kalman",
+	"draw",
+	"emit",
+	"cycle",
+};
+
+UevaProfiler::UevaProfiler()
+{
+	history.assign(WINDOW * NUM_STAGES, -1);
+	numCycles = 0;
+	next = 0;
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		starts[i] = 0;
+		current[i] = -1;
+	}
+	timer.start();
+}
+
+void UevaProfiler::startCycle()
+{
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		current[i] = -1;
+	}
+	begin(CYCLE);
+}
+
+void UevaProfiler::begin(const int stage)
+{
+	starts[stage] = timer.nsecsElapsed();
+}
+
+void UevaProfiler::end(const int stage)
+{
+	add(stage, timer.nsecsElapsed() - starts[stage]);
+}
+
+void UevaProfiler::endNested(const int stage, const int outer)
+{
+	qint64 ns = timer.nsecsElapsed() - starts[stage];
+	add(stage, ns);
+	starts[outer] += ns;
+}
+
+void UevaProfiler::add(const int stage, const qint64 ns)
+{
+	current[stage] = std::max(current[stage], qint64(0)) + ns;
+}
+
+void UevaProfiler::endCycle()
+{
+	end(CYCLE);
+	std::copy(current, current + NUM_STAGES, history.begin() + next * NUM_STAGES);
+	next = (next + 1) % WINDOW;
+	numCycles++;
+}
+
+void UevaProfiler::percentiles(const int stage, qint64 &p50, qint64 &p95, qint64 &p99, qint64 &max) const
+{
+	std::vector<qint64> samples;
+	samples.reserve(WINDOW);
+	int numRows = std::min(numCycles, (int)WINDOW);
+	for (int i = 0; i < numRows; i++)
+	{
+		qint64 ns = history[i * NUM_STAGES + stage];
+		if (ns >= 0)
+		{
+			samples.push_back(ns);
+		}
+	}
+	p50 = p95 = p99 = max = 0;
+	if (samples.empty())
+	{
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	int n = (int)samples.size();
+	p50 = samples[(n - 1) * 50 / 100];
+	p95 = samples[(n - 1) * 95 / 100];
+	p99 = samples[(n - 1) * 99 / 100];
+	max = samples[n - 1];
+}
+
+QString UevaProfiler::summary() const
+{
+	qint64 p50, p95, p99, max;
+	percentiles(CYCLE, p50, p95, p99, max);
+	QString str = QString("Cycle p50/p95/p99/max: %1/%2/%3/%4 ms")
+		.arg(p50 / 1e6, 0, 'f', 2)
+		.arg(p95 / 1e6, 0, 'f', 2)
+		.arg(p99 / 1e6, 0, 'f', 2)
+		.arg(max / 1e6, 0, 'f', 2);
+
+	// stage most responsible for slow cycles
+	int worstStage = -1;
+	qint64 worstP99 = 0;
+	for (int i = 0; i < CYCLE; i++)
+	{
+		percentiles(i, p50, p95, p99, max);
+		if (p99 > worstP99)
+		{
+			worstP99 = p99;
+			worstStage = i;
+		}
+	}
+	if (worstStage != -1)
+	{
+		str.append(QString("	Slowest p99: %1 %2 ms")
+			.arg(stageNames[worstStage])
+			.arg(worstP99 / 1e6, 0, 'f', 2));
+	}
+	return str;
+}
+
+bool UevaProfiler::dump(const std::string &fileName) const
+{
+	std::ofstream fileStream(fileName);
+	if (!fileStream.is_open())
+	{
+		return false;
+	}
+
+	// percentiles first, then every cycle in window oldest to newest, microseconds, -1 did not run
+	fileStream << "stage,p50,p95,p99,max" << std::endl;
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		qint64 p50, p95, p99, max;
+		percentiles(i, p50, p95, p99, max);
+		fileStream << stageNames[i] << "," << p50 / 1000 << "," << p95 / 1000 << ","
+			<< p99 / 1000 << "," << max / 1000 << std::endl;
+	}
+	fileStream << std::endl;
+
+	fileStream << "cycle,";
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		fileStream << stageNames[i] << ",";
+	}
+	fileStream << std::endl;
+	int numRows = std::min(numCycles, (int)WINDOW);
+	int first = numCycles > WINDOW ? next : 0;
+	for (int r = 0; r < numRows; r++)
+	{
+		int row = (first + r) % WINDOW;
+		fileStream << numCycles - numRows + r << ",";
+		for (int i = 0; i < NUM_STAGES; i++)
+		{
+			qint64 ns = history[row * NUM_STAGES + i];
+			fileStream << (ns < 0 ? -1 : ns / 1000) << ",";
+		}
+		fileStream << std::endl;
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVAPROFILER_H
+#define UEVAPROFILER_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <QtGui >
+#include <QElapsedTimer >
+
+// per stage nanosecond timing of engine cycles, last WINDOW cycles kept for percentiles
+struct UevaProfiler
+{
+	UevaProfiler();
+
+	enum Stages
+	{
+		MASK,
+		ABSDIFF,
+		FILL,
+		CONTOURS,
+		BKGD,
+		TRACKING,
+		KINK_NECK,
+		INPUT,
+		DESIGN,
+		KALMAN,
+		DRAW,
+		EMIT,
+		CYCLE,
+		NUM_STAGES,
+	};
+	enum Constants
+	{
+		WINDOW = 1024,
+	};
+
+	void startCycle();
+	void begin(const int stage);
+	void end(const int stage);
+	void endNested(const int stage, const int outer); // stage ran inside open outer stage, outer leaves it out
+	void add(const int stage, const qint64 ns);
+	void endCycle();
+
+	void percentiles(const int stage, qint64 &p50, qint64 &p95, qint64 &p99, qint64 &max) const;
+	QString summary() const;
+	bool dump(const std::string &fileName) const;
+
+	static const char *stageNames[NUM_STAGES];
+
+	QElapsedTimer timer; // monotonic
+	qint64 starts[NUM_STAGES];
+	qint64 current[NUM_STAGES]; // -1 when stage did not run this cycle
+	std::vector<qint64> history; // WINDOW rows of NUM_STAGES
+	int numCycles;
+	int next;
+};
+
+#endif // UEVAPROFILER_H
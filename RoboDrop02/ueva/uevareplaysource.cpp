@@ -0,0 +1,333 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "uevareplaysource.h"
+
+#include <algorithm>
+
+UevaReplaySource::UevaReplaySource()
+{
+	kind = KIND_VIDEO;
+	isOpen = false;
+	stackIndex = 0;
+	hasFirst = false;
+	paceRate = 0;
+	nextSequence = 0;
+	dropCount = 0;
+	setSettings(defaultSettings());
+}
+
+UevaReplaySource::~UevaReplaySource()
+{
+	stop();
+}
+
+//// SETTINGS
+QMap<QString, QString> UevaReplaySource::defaultSettings()
+{
+	QMap<QString, QString> s;
+	s["ReplayPath"] = "record/replay.avi"; // avi, image sequence like frame_%04d.png, tif stack, raw dump
+	s["ReplayPacing"] = "RealTime"; // RealTime FixedRate Fastest
+	s["ReplayFrameRate"] = "40"; // Hz, for tif and raw, and fixed rate
+	s["ReplayLoop"] = "1";
+	s["RawWidth"] = "2560"; // pixel, raw dump has no header
+	s["RawHeight"] = "2160";
+	s["RawBitDepth"] = "16"; // 8 or 16, little endian
+	return s;
+}
+
+QMap<QString, QString> UevaReplaySource::getSettings()
+{
+	return settings;
+}
+
+void UevaReplaySource::setSettings(const QMap<QString, QString> &s)
+{
+	settings = s;
+	QString newPath = s.value("ReplayPath");
+	if (newPath != path)
+	{
+		aoi = cv::Rect_<int>(); // new file starts uncropped
+	}
+	path = newPath;
+	QString p = s.value("ReplayPacing");
+	pacing = p == "Fastest" ? PACING_FASTEST :
+		p == "FixedRate" ? PACING_FIXED_RATE : PACING_REAL_TIME;
+	frameRate = s.value("ReplayFrameRate").toDouble();
+	loop = s.value("ReplayLoop").toInt() != 0;
+	rawWidth = s.value("RawWidth").toInt();
+	rawHeight = s.value("RawHeight").toInt();
+	rawBitDepth = s.value("RawBitDepth").toInt();
+}
+
+//// ACQUISITION
+bool UevaReplaySource::open()
+{
+	QString suffix = QFileInfo(path).suffix().toLower();
+	if (suffix == "tif" || suffix == "tiff")
+	{
+		// whole stack in memory, pages are not seekable otherwise
+		kind = KIND_STACK;
+		stack.clear();
+		stackIndex = 0;
+		cv::imreadmulti(path.toStdString(), stack, cv::IMREAD_UNCHANGED);
+		return !stack.empty();
+	}
+	else if (suffix == "raw" || suffix == "bin" || suffix == "dat")
+	{
+		kind = KIND_RAW;
+		if (rawWidth <= 0 || rawHeight <= 0 || (rawBitDepth != 8 && rawBitDepth != 16))
+		{
+			return false;
+		}
+		rawStream.open(path.toStdString().c_str(), std::ios::in | std::ios::binary);
+		rawBuffer.resize((size_t)rawWidth * rawHeight * (rawBitDepth / 8));
+		return rawStream.is_open();
+	}
+	else
+	{
+		kind = KIND_VIDEO;
+		return capture.open(path.toStdString());
+	}
+}
+
+bool UevaReplaySource::readFrame(cv::Mat &f)
+{
+	if (hasFirst)
+	{
+		f = first;
+		first.release();
+		hasFirst = false;
+		return true;
+	}
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		bool ok = false;
+		if (kind == KIND_VIDEO)
+		{
+			ok = capture.read(f);
+		}
+		else if (kind == KIND_STACK)
+		{
+			if (stackIndex < stack.size())
+			{
+				f = stack[stackIndex++];
+				ok = true;
+			}
+		}
+		else
+		{
+			rawStream.read(reinterpret_cast<char *>(rawBuffer.data()), rawBuffer.size());
+			ok = rawStream.gcount() == (std::streamsize)rawBuffer.size();
+			if (ok)
+			{
+				f = cv::Mat(rawHeight, rawWidth, rawBitDepth == 16 ? CV_16UC1 : CV_8UC1, rawBuffer.data());
+			}
+		}
+		if (ok || !loop)
+		{
+			return ok;
+		}
+		//// rewind
+		if (kind == KIND_VIDEO)
+		{
+			capture.set(cv::CAP_PROP_POS_FRAMES, 0);
+		}
+		else if (kind == KIND_STACK)
+		{
+			stackIndex = 0;
+		}
+		else
+		{
+			rawStream.clear();
+			rawStream.seekg(0);
+		}
+	}
+	return false;
+}
+
+void UevaReplaySource::start(const int &periodMs)
+{
+	stop();
+	isOpen = open() && readFrame(first);
+	if (!isOpen)
+	{
+		std::cout << "FAIL: replay can not read " << path.toStdString() << std::endl;
+		stop();
+		return;
+	}
+	hasFirst = true;
+	fullSize = first.size();
+	if (aoi.area() == 0 || (aoi & cv::Rect_<int>(cv::Point_<int>(0, 0), fullSize)) != aoi)
+	{
+		aoi = cv::Rect_<int>(cv::Point_<int>(0, 0), fullSize);
+	}
+
+	//// real time follows file rate when it has one, otherwise setting, otherwise engine period
+	paceRate = frameRate;
+	if (kind == KIND_VIDEO && pacing == PACING_REAL_TIME && capture.get(cv::CAP_PROP_FPS) > 0)
+	{
+		paceRate = capture.get(cv::CAP_PROP_FPS);
+	}
+	if (paceRate <= 0)
+	{
+		paceRate = 1000.0 / std::max(periodMs, 1);
+	}
+
+	nextSequence = 0;
+	dropCount = 0;
+	lastInfo = UevaFrameInfo();
+	clock.start();
+}
+
+void UevaReplaySource::stop()
+{
+	capture.release();
+	stack.clear();
+	if (rawStream.is_open())
+	{
+		rawStream.close();
+	}
+	rawStream.clear();
+	first.release();
+	frame.release();
+	hasFirst = false;
+	isOpen = false;
+}
+
+bool UevaReplaySource::processGray(cv::Mat &gray, const unsigned int timeout, const bool parallel)
+{
+	if (!isOpen)
+	{
+		QThread::msleep(timeout); // nothing will come, do not spin camera thread
+		return false;
+	}
+
+	//// pace, frame n is due n / paceRate after start
+	if (pacing != PACING_FASTEST)
+	{
+		qint64 due = (qint64)(1.0e9 * nextSequence / paceRate);
+		qint64 waitMs = (due - clock.nsecsElapsed()) / 1000000;
+		if (waitMs > (qint64)timeout)
+		{
+			QThread::msleep(timeout);
+			return false;
+		}
+		if (waitMs > 0)
+		{
+			QThread::msleep((unsigned long)waitMs);
+		}
+		if (pacing == PACING_REAL_TIME)
+		{
+			// camera would have made these while reader was late, they are lost like on camera
+			qint64 latest = (qint64)(clock.nsecsElapsed() * 1.0e-9 * paceRate);
+			while (nextSequence < latest && readFrame(frame))
+			{
+				nextSequence++;
+				dropCount++;
+			}
+		}
+	}
+
+	//// deliver
+	if (!readFrame(frame))
+	{
+		stop();
+		return false;
+	}
+	if (!toGray(frame, gray, parallel))
+	{
+		stop();
+		return false;
+	}
+	lastInfo.sequence = nextSequence;
+	lastInfo.timestamp = nextSequence / paceRate;
+	lastInfo.hostNs = clock.nsecsElapsed();
+	nextSequence++;
+	return true;
+}
+
+bool UevaReplaySource::toGray(const cv::Mat &f, cv::Mat &gray, const bool parallel)
+{
+	// runs on camera thread, a bad file stops replay instead of throwing there
+	if (f.size() != fullSize)
+	{
+		std::cout << "FAIL: replay frame " << nextSequence << " is " << f.cols << "x" << f.rows <<
+			", first was " << fullSize.width << "x" << fullSize.height << std::endl;
+		return false;
+	}
+	cv::Mat roi = f(aoi);
+	gray.create(aoi.height, aoi.width, CV_8UC1);
+	switch (roi.type())
+	{
+	case CV_8UC1:
+		roi.copyTo(gray);
+		break;
+	case CV_8UC3:
+		cv::cvtColor(roi, gray, cv::COLOR_BGR2GRAY);
+		break;
+	case CV_16UC1:
+		// same scaling as live Mono16
+		Ueva::unpackTo8u(roi.data, roi.step, Ueva::PIXEL_MONO16, gray, parallel);
+		break;
+	default:
+		std::cout << "FAIL: replay frame is not 8 bit gray, 8 bit bgr or 16 bit gray" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool UevaReplaySource::cropAoi(cv::Rect_<int> &roi)
+{
+	// only after a start told frame size
+	if (aoi.area() == 0 || roi.area() <= 0 ||
+		(roi & cv::Rect_<int>(cv::Point_<int>(0, 0), aoi.size())) != roi)
+	{
+		return false;
+	}
+	aoi = cv::Rect_<int>(aoi.x + roi.x, aoi.y + roi.y, roi.width, roi.height);
+	return true;
+}
+
+//// BOOKKEEPING
+cv::Size_<int> UevaReplaySource::frameSize() const
+{
+	return aoi.size();
+}
+
+const UevaFrameInfo &UevaReplaySource::frameInfo() const
+{
+	return lastInfo;
+}
+
+qint64 UevaReplaySource::droppedFrames() const
+{
+	return dropCount;
+}
+
+int UevaReplaySource::overflows() const
+{
+	return 0;
+}
+
+bool UevaReplaySource::holdsFrames() const
+{
+	return pacing == PACING_FASTEST;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVAREPLAYSOURCE_H
+#define UEVAREPLAYSOURCE_H
+
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "uevaframesource.h"
+#include "uevaunpack.h"
+
+// recorded frames in place of camera, so whole engine runs without hardware
+// avi or printf style image sequence through videoio, tiff stack, or headerless raw dump of 8 or 16 bit frames
+// 16 bit frames are scaled like camera Mono16, so a recorded tiff replays exactly as it was seen live
+class UevaReplaySource : public UevaFrameSource
+{
+public:
+	UevaReplaySource();
+	~UevaReplaySource();
+
+	QMap<QString, QString> defaultSettings();
+	QMap<QString, QString> getSettings();
+	void setSettings(const QMap<QString, QString> &s);
+	void start(const int &periodMs);
+	void stop();
+	bool processGray(cv::Mat &gray, const unsigned int timeout = 0, const bool parallel = false);
+	bool cropAoi(cv::Rect_<int> &roi);
+	cv::Size_<int> frameSize() const;
+	const UevaFrameInfo &frameInfo() const;
+	qint64 droppedFrames() const;
+	int overflows() const;
+	bool holdsFrames() const;
+
+	enum Pacing
+	{
+		PACING_REAL_TIME = 0, // file rate, late frames dropped like camera would
+		PACING_FIXED_RATE = 1, // ReplayFrameRate, every frame delivered, late ones as soon as possible
+		PACING_FASTEST = 2, // next frame as soon as previous one is taken
+	};
+
+private:
+	enum Kind
+	{
+		KIND_VIDEO = 0,
+		KIND_STACK = 1,
+		KIND_RAW = 2,
+	};
+
+	bool open();
+	bool readFrame(cv::Mat &frame); // next frame of file, rewinds when looping
+	bool toGray(const cv::Mat &frame, cv::Mat &gray, const bool parallel);
+
+	QMap<QString, QString> settings;
+	QString path;
+	int pacing;
+	double frameRate; // setting, for files without own rate and fixed rate pacing
+	double paceRate; // frames per second used for pacing and timestamps
+	bool loop;
+	int rawWidth;
+	int rawHeight;
+	int rawBitDepth;
+
+	int kind;
+	bool isOpen;
+	cv::VideoCapture capture;
+	std::vector<cv::Mat> stack;
+	int stackIndex;
+	std::ifstream rawStream;
+	std::vector<uchar> rawBuffer;
+	cv::Mat first; // read by start for frame size, delivered first
+	bool hasFirst;
+	cv::Mat frame;
+
+	cv::Size_<int> fullSize;
+	cv::Rect_<int> aoi; // of full frame, kept over stop and start, reset by new file
+	QElapsedTimer clock;
+	qint64 nextSequence; // of frame to deliver next, counts loops
+	UevaFrameInfo lastInfo;
+	qint64 dropCount;
+};
+
+#endif // UEVAREPLAYSOURCE_H
@@ -0,0 +1,90 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVASPSCQUEUE_H
+#define UEVASPSCQUEUE_H
+
+#include <vector>
+#include <atomic>
+
+// bounded lock free queue, exactly one producer thread and one consumer thread
+template <typename T>
+class UevaSpscQueue
+{
+public:
+	explicit UevaSpscQueue(const int capacity)
+		: slots(capacity + 1), head(0), tail(0)
+	{
+	}
+
+	// producer, false when full
+	bool push(const T &item)
+	{
+		int t = tail.load(std::memory_order_relaxed);
+		int next = (t + 1) % (int)slots.size();
+		if (next == head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		slots[t] = item;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// consumer, false when empty
+	bool pop(T &item)
+	{
+		int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+		item = slots[h];
+		slots[h] = T(); // drop references held by slot
+		head.store((h + 1) % (int)slots.size(), std::memory_order_release);
+		return true;
+	}
+
+	// consumer, keep only latest item, returns number of items taken
+	int popNewest(T &item)
+	{
+		int count = 0;
+		while (pop(item))
+		{
+			count++;
+		}
+		return count;
+	}
+
+	bool empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	UevaSpscQueue(const UevaSpscQueue &);
+	UevaSpscQueue &operator=(const UevaSpscQueue &);
+
+	std::vector<T> slots; // one slot always empty to tell full from empty
+	std::atomic<int> head; // next to pop, written by consumer
+	std::atomic<int> tail; // next to push, written by producer
+};
+
+#endif // UEVASPSCQUEUE_H
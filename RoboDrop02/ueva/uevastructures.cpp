@@ -26,6 +26,7 @@ UevaSettings::UevaSettings()
 {
 	flag = 0;
 	displayScale = 1.0;
+	bkgdRate = 0.01f;
 	for (int i = 0; i < 10; i++) // limited by 0-9 on keyboard
 	{
 		linkRequests.push_back(false);
@@ -190,7 +191,7 @@ void UevaBuffer::write(const UevaData &data)
 //// CTRL
 UevaCtrl::UevaCtrl()
 {
-
+	steadyNoise = cv::Vec3d(-1.0, -1.0, -1.0); // not solved
 }
 
 int UevaCtrl::index = 0;
@@ -199,6 +200,18 @@ int UevaCtrl::numPlantInput = 0;
 int UevaCtrl::numPlantOutput = 0;
 double UevaCtrl::samplePeriod = 0;
 
+UevaPlant::UevaPlant()
+{
+	isfbQIntegral = 0;
+	isfbR = 0;
+	obsrR = 0;
+}
+
+bool UevaPlant::empty() const
+{
+	return A.empty();
+}
+
 
 
 //// CHANNEL
@@ -267,6 +280,61 @@ void UevaChannel::makeChannelText(std::string &str, double &fontScale, cv::Scala
 }
 
 
+//// MARKER
+UevaMarker::UevaMarker()
+{
+	identity = -1;
+	velocity = cv::Point_<float>(0, 0);
+	area = 0;
+}
+
+int UevaMarker::counter = 0;
+
+
+
+//// BLOB SCRATCH
+UevaBlobScratch::UevaBlobScratch()
+{
+
+}
+
+
+
+//// TILE
+UevaTile::UevaTile()
+{
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		stageNs[i] = 0;
+	}
+}
+
+
+
+//// FRAME
+UevaFrame::UevaFrame()
+{
+	sequence = -1;
+	for (int i = 0; i < UevaTile::NUM_STAGES; i++)
+	{
+		stageNs[i] = 0;
+	}
+}
+
+
+
+//// BACKGROUND MODEL
+float UevaBkgdModel::initialVariance = 25.0f;
+float UevaBkgdModel::minVariance = 1.0f;
+float UevaBkgdModel::gateSquared = 9.0f;
+
+UevaBkgdModel::UevaBkgdModel()
+{
+
+}
+
+
+
 //// DROPLET
 UevaDroplet::UevaDroplet()
 {
@@ -278,10 +346,8 @@ std::ofstream UevaDroplet::fileStream;
 
 
 
-//// MARKER
-UevaMarker::UevaMarker()
+//// SHAPE SCRATCH
+UevaShapeScratch::UevaShapeScratch()
 {
-	identity = -1;
-}
 
-int UevaMarker::counter = 0;
+}
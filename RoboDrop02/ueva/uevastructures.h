@@ -24,7 +24,10 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <unordered_map>
 #include "opencv2/core.hpp"
+#include "persistence1d.hpp"
+#include "uevabitimage.h"
 
 struct UevaSettings
 {
@@ -45,9 +48,18 @@ struct UevaSettings
 		RECORD_DATA = 1024,
 		RECORD_RAW = 2048,
 		RECORD_DRAWN = 4096,
+		IMGPROC_TILED = 8192,
+		BKGD_ADAPTIVE = 16384,
+		ENGINE_PIPELINED = 32768,
+		TRACK_OPTIMAL = 65536,
+		TRACK_WINDOWED = 131072,
+		CTRL_STEADY = 262144,
+		FRAME_TRIGGERED = 524288,
+		UNPACK_PARALLEL = 1048576,
 	};
 	int flag;
 	double displayScale;
+	float bkgdRate;
 
 	QVector<QVector<int>> inletInfo;
 	QVector<qreal> inletRequests;
@@ -141,6 +153,29 @@ struct UevaCtrl
 	cv::Mat Bd;
 	cv::Mat Cd;
 	cv::Mat Wd;
+
+	cv::Mat steadyGain; // kalman gain solved from riccati equation, empty when not converged
+	cv::Vec3d steadyNoise; // model, disturbance and sensor cov steadyGain was solved for
+};
+
+// controller index keyed by bit mask of its output channels, built by Ueva::indexCtrls
+typedef std::unordered_map<uint64, int> UevaCtrlLookup;
+
+// full discrete chip model and lqr weights, lets engine design controller of any channel subset
+struct UevaPlant
+{
+	UevaPlant();
+	bool empty() const;
+
+	cv::Mat A; // first UevaCtrl::numPlantOutput states are channel positions
+	cv::Mat B;
+	cv::Mat C;
+	cv::Mat D;
+	cv::Mat isfbQ; // 1 x numPlantState, integral state feed back weight of each plant state
+	cv::Mat obsrQ; // 1 x numPlantState, luenburger observer weight of each plant state
+	double isfbQIntegral;
+	double isfbR;
+	double obsrR;
 };
 
 struct UevaChannel
@@ -150,7 +185,7 @@ struct UevaChannel
 	void makeChannelText(std::string &str, double &fontScale, cv::Scalar_<int> &lineColor,
 		const bool &linkRequest, const bool &inverseLinkRequest);
 
-	cv::Mat mask;
+	cv::Mat mask; // cropped to rect
 	cv::Rect rect;
 	int index;
 	int direction;
@@ -160,11 +195,86 @@ struct UevaChannel
 	int neckDropletIndex;
 };
 
+struct UevaMarker
+{
+	UevaMarker();
+
+	int identity;
+	cv::Point_<int> centroid;
+	cv::Point_<float> velocity; // pixel per cycle since last identity match
+	cv::Rect_<int> rect;
+	cv::Rect_<int> blob; // bounding box of marker pixels
+	int area; // number of marker pixels
+	
+	static int counter;
+};
+
+struct UevaBlobScratch
+{
+	UevaBlobScratch();
+
+	cv::Mat labels;
+	cv::Mat stats;
+	cv::Mat centroids;
+};
+
+struct UevaTile
+{
+	UevaTile();
+
+	enum Stages
+	{
+		SUBTRACT,
+		FILL,
+		CONTOURS,
+		NUM_STAGES,
+	};
+
+	cv::Rect rect; // processed area, core plus halo
+	cv::Rect core; // channel rect, or union of all channel rects
+	cv::Mat edges;
+	UevaBitImage bits;
+	UevaBlobScratch blobs;
+	cv::Mat allMarkers;
+	cv::Mat allDroplets;
+	std::vector<UevaMarker> markers;
+	std::vector<std::vector< cv::Point_<int> >> dropletContours;
+	qint64 stageNs[NUM_STAGES];
+};
+
+struct UevaFrame
+{
+	UevaFrame();
+
+	qint64 sequence;
+	UevaSettings settings;
+	UevaData data;
+	cv::Mat allMarkers;
+	cv::Mat allDroplets;
+	std::vector<UevaMarker> markers;
+	std::vector<std::vector< cv::Point_<int> >> dropletContours;
+	qint64 stageNs[UevaTile::NUM_STAGES];
+};
+
+struct UevaBkgdModel
+{
+	UevaBkgdModel();
+
+	static float initialVariance;
+	static float minVariance;
+	static float gateSquared;
+
+	cv::Rect_<int> region; // learnt part of frame, union of channel rects
+	cv::Mat mean; // CV_32FC1, region only
+	cv::Mat variance; // CV_32FC1, region only
+	cv::Mat front; // 8 bit full frame background handed to readers
+	cv::Mat back; // 8 bit full frame background being written, never reallocated
+};
+
 struct UevaDroplet
 {
 	UevaDroplet();
 
-	cv::Mat mask;
 	int kinkIndex;
 	int neckIndex;
 	float neckDistance;
@@ -172,15 +282,21 @@ struct UevaDroplet
 	static std::ofstream fileStream;
 };
 
-struct UevaMarker
+struct UevaShapeScratch
 {
-	UevaMarker();
-
-	int identity;
-	cv::Point_<int> centroid;
-	cv::Rect_<int> rect;
-	
-	static int counter;
+	UevaShapeScratch();
+
+	std::vector< cv::Point_<int>> simplified;
+	std::vector<int> indices; // full contour index of each simplified point
+	std::vector<cv::Vec2i> ranges;
+	std::vector<int> hull;
+	std::vector<cv::Vec4i> defects;
+	std::vector<float> profile;
+	std::vector<int> stack;
+	std::vector<int> leftLowest;
+	std::vector<int> rightLowest;
+	std::vector<p1d::TPairedExtrema> extremas;
+	std::vector<float> logged; // neck profiles of this cycle, written after analysis
 };
 
 Q_DECLARE_METATYPE(UevaSettings)
@@ -188,6 +304,9 @@ Q_DECLARE_METATYPE(UevaData)
 Q_DECLARE_METATYPE(UevaBuffer)
 Q_DECLARE_METATYPE(UevaCtrl)
 Q_DECLARE_METATYPE(UevaChannel)
+Q_DECLARE_METATYPE(UevaTile)
+Q_DECLARE_METATYPE(UevaFrame)
+Q_DECLARE_METATYPE(UevaBkgdModel)
 Q_DECLARE_METATYPE(UevaDroplet)
 Q_DECLARE_METATYPE(UevaMarker)
 
@@ -0,0 +1,202 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "uevaunpack.h"
+
+#include <cwchar>
+#include <algorithm>
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#define UEVA_SSSE3 // msvc always has ssse3 intrinsics, use is decided at runtime
+#endif
+
+int Ueva::pixelEncoding(const wchar_t *name)
+{
+	if (std::wcscmp(name, L"Mono12") == 0)
+	{
+		return PIXEL_MONO12;
+	}
+	if (std::wcscmp(name, L"Mono12Packed") == 0)
+	{
+		return PIXEL_MONO12_PACKED;
+	}
+	if (std::wcscmp(name, L"Mono16") == 0)
+	{
+		return PIXEL_MONO16;
+	}
+	return PIXEL_UNSUPPORTED;
+}
+
+//// SCALAR
+
+// v / 256 rounded half to even and saturated, which is what convertTo does
+static inline uchar scaleTo8u(const unsigned int v)
+{
+	unsigned int q = (v + 127 + ((v >> 8) & 1)) >> 8;
+	return (uchar)std::min(q, 255u);
+}
+
+static void unpackWordsRow(const uchar *s, uchar *d, int x, const int width)
+{
+	for (; x < width; x++)
+	{
+		d[x] = scaleTo8u(s[2 * x] | (s[2 * x + 1] << 8));
+	}
+}
+
+static void unpackPackedRow(const uchar *s, uchar *d, int x, const int width)
+{
+	for (; x < width; x++)
+	{
+		const uchar *pair = s + 3 * (x >> 1);
+		unsigned int v = x & 1 ?
+			(pair[2] << 4) | (pair[1] >> 4) :
+			(pair[0] << 4) | (pair[1] & 15);
+		d[x] = scaleTo8u(v);
+	}
+}
+
+//// SSE2 AND SSSE3
+
+// same rounding as scaleTo8u on 8 words, adds saturate so 65535 still gives 255
+static inline __m128i scaleTo8uSse2(const __m128i v)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i half = _mm_set1_epi16(127);
+	__m128i odd = _mm_and_si128(_mm_srli_epi16(v, 8), one);
+	return _mm_srli_epi16(_mm_adds_epu16(_mm_adds_epu16(v, half), odd), 8);
+}
+
+static int unpackWordsRowSse2(const uchar *s, uchar *d, const int width)
+{
+	int x = 0;
+	for (; x <= width - 16; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i*)(s + 2 * x));
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(s + 2 * x + 16));
+		_mm_storeu_si128((__m128i*)(d + x), _mm_packus_epi16(scaleTo8uSse2(v0), scaleTo8uSse2(v1)));
+	}
+	return x;
+}
+
+#ifdef UEVA_SSSE3
+// 4 pairs in 12 bytes to 8 words, a pixels get high byte b0 low byte b1, b pixels high byte b2 low byte b1
+static inline __m128i unpackPairsSsse3(const __m128i bytes)
+{
+	const __m128i order = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+	const __m128i high = _mm_set1_epi16(0x0ff0);
+	const __m128i lowA = _mm_set1_epi32(0x0000000f);
+	const __m128i lowB = _mm_set1_epi32(0x000f0000);
+	__m128i w = _mm_shuffle_epi8(bytes, order);
+	__m128i shifted = _mm_srli_epi16(w, 4);
+	__m128i v = _mm_and_si128(shifted, high);
+	v = _mm_or_si128(v, _mm_and_si128(w, lowA));
+	return _mm_or_si128(v, _mm_and_si128(shifted, lowB));
+}
+
+static int unpackPackedRowSsse3(const uchar *s, uchar *d, const int width)
+{
+	int x = 0;
+	// 16 pixels use 24 bytes but second load reads 28, margin keeps it inside the row
+	for (; x <= width - 20; x += 16)
+	{
+		const uchar *p = s + 3 * (x >> 1);
+		__m128i v0 = unpackPairsSsse3(_mm_loadu_si128((const __m128i*)p));
+		__m128i v1 = unpackPairsSsse3(_mm_loadu_si128((const __m128i*)(p + 12)));
+		_mm_storeu_si128((__m128i*)(d + x), _mm_packus_epi16(scaleTo8uSse2(v0), scaleTo8uSse2(v1)));
+	}
+	return x;
+}
+#endif
+
+//// ROWS
+
+static void unpackRows(const uchar *src, const size_t stride, const int encoding, cv::Mat &dst,
+	const int begin, const int end)
+{
+	bool useSse2 = cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSE2);
+	bool useSsse3 = false;
+#ifdef UEVA_SSSE3
+	useSsse3 = cv::useOptimized() && cv::checkHardwareSupport(CV_CPU_SSSE3);
+#endif
+
+	for (int y = begin; y < end; y++)
+	{
+		const uchar *s = src + y * stride;
+		uchar *d = dst.ptr<uchar>(y);
+		int x = 0;
+		if (encoding == Ueva::PIXEL_MONO12_PACKED)
+		{
+#ifdef UEVA_SSSE3
+			if (useSsse3)
+			{
+				x = unpackPackedRowSsse3(s, d, dst.cols);
+			}
+#endif
+			unpackPackedRow(s, d, x, dst.cols);
+		}
+		else
+		{
+			if (useSse2)
+			{
+				x = unpackWordsRowSse2(s, d, dst.cols);
+			}
+			unpackWordsRow(s, d, x, dst.cols);
+		}
+	}
+}
+
+class UnpackRowsBody : public cv::ParallelLoopBody
+{
+public:
+	UnpackRowsBody(const uchar *s, const size_t st, const int e, cv::Mat &d)
+		: src(s), stride(st), encoding(e), dst(d)
+	{
+	}
+
+	void operator()(const cv::Range &range) const
+	{
+		unpackRows(src, stride, encoding, dst, range.start, range.end);
+	}
+
+private:
+	const uchar *src;
+	size_t stride;
+	int encoding;
+	cv::Mat &dst;
+};
+
+void Ueva::unpackTo8u(const uchar *src, const size_t stride, const int encoding, cv::Mat &dst, const bool parallel)
+{
+	CV_Assert(dst.type() == CV_8UC1);
+	CV_Assert(encoding == PIXEL_MONO12 || encoding == PIXEL_MONO12_PACKED || encoding == PIXEL_MONO16);
+	CV_Assert(stride >= (encoding == PIXEL_MONO12_PACKED ? (size_t)(3 * dst.cols + 1) / 2 : (size_t)2 * dst.cols));
+
+	if (parallel && dst.rows > 1)
+	{
+		// rows are independent, one stripe per worker keeps each stripe streaming
+		cv::parallel_for_(cv::Range(0, dst.rows), UnpackRowsBody(src, stride, encoding, dst), cv::getNumThreads());
+	}
+	else
+	{
+		unpackRows(src, stride, encoding, dst, 0, dst.rows);
+	}
+}
@@ -0,0 +1,45 @@
+/*
+Copyright 2016 David Wong
+
+This file is part of RoboDrop from the uEVA project. https://github.com/DaveSketchySpeedway/uEVA
+
+RoboDrop is free software : you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+any later version.
+
+RoboDrop is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#ifndef UEVAUNPACK_H
+#define UEVAUNPACK_H
+
+#include "opencv2/core.hpp"
+
+namespace Ueva
+{
+	enum PixelEncoding
+	{
+		PIXEL_MONO12 = 0, // 12 bit value in little endian 16 bit word
+		PIXEL_MONO12_PACKED = 1, // 2 pixels in 3 bytes, high 8 bits of each then shared byte of low nibbles
+		PIXEL_MONO16 = 2, // 16 bit little endian word
+		PIXEL_UNSUPPORTED = -1,
+	};
+
+	// camera pixel encoding name to PixelEncoding
+	int pixelEncoding(const wchar_t *name);
+
+	// raw camera rows straight to 8 bit, same values as converting to Mono16 then convertTo with alpha 1/256
+	// dst must already be created with frame size and CV_8UC1, stride is bytes per raw row
+	// parallel splits rows over opencv worker threads
+	void unpackTo8u(const uchar *src, const size_t stride, const int encoding, cv::Mat &dst, const bool parallel = false);
+}
+
+#endif // UEVAUNPACK_H
@@ -18,6 +18,7 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "zyla.h"
+#ifndef UEVA_NO_ANDOR
 
 ZylaSettings::ZylaSettings()
 {
@@ -29,8 +30,8 @@ ZylaSettings::ZylaSettings()
 	//boolMap[L"RollingShutterGlobalClear"] = false; // faster clear
 	//boolMap[L"ScanSpeedControlEnable"] = false; // allow change line row scan
 	boolMap[L"SensorCooling"] = true;
-	boolMap[L"MetadataEnable"] = false;
-	boolMap[L"MetadataTimestamp"] = false;
+	boolMap[L"MetadataEnable"] = true; // blocks after image, needed for timestamp
+	boolMap[L"MetadataTimestamp"] = true; // frame drops show as gaps
 	boolMap[L"MetadataFrameinfo"] = false;
 
 	intMap[L"FrameCount"] = 1; // number of images to acquire in each sequence
@@ -618,17 +619,40 @@ void Zyla::set(ZylaSettings &s)
 	std::cout << std::endl;
 }
 
-void Zyla::start(const int &Ts)
+QMap<QString, QString> Zyla::defaultSettings()
+{
+	settings = ZylaSettings();
+	return settings.allMap;
+}
+
+QMap<QString, QString> Zyla::getSettings()
+{
+	get(settings);
+	settings.collapse();
+	return settings.allMap;
+}
+
+void Zyla::setSettings(const QMap<QString, QString> &s)
+{
+	settings.allMap = s;
+	settings.expand();
+	settings.print();
+	set(settings);
+}
+
+void Zyla::start(const int &periodMs)
 {
 	//// flush queue and wait buffers;
 	returnCode = AT_Flush(handle);
 
 	//// get info
-	samplePeriod = Ts;
+	samplePeriod = periodMs;
 	returnCode = AT_GetInt(handle, L"ImageSizeBytes", &imageSizeBytes);
 	bufferSize = (int)(imageSizeBytes);
 	returnCode = AT_GetFloat(handle, L"FrameRate", &frameRate);
-	queueLength = (int)(frameRate * samplePeriod + 1); // min length = 1;
+	// every frame of one period plus the one being unpacked
+	queueLength = std::max((int)MIN_QUEUE_LENGTH,
+		(int)std::ceil(frameRate * std::max(samplePeriod, (int)MIN_RING_MS) / 1000.0) + 1);
 	returnCode = AT_GetInt(handle, L"AOIStride", &imageStride);
 	returnCode = AT_GetInt(handle, L"AOIWidth", &imageWidth);
 	returnCode = AT_GetInt(handle, L"AOIHeight", &imageHeight);
@@ -637,6 +661,14 @@ void Zyla::start(const int &Ts)
 	returnCode = AT_GetEnumIndex(handle, L"Pixel Encoding", &index);
 	returnCode = AT_GetEnumStringByIndex(handle, L"Pixel Encoding", index, str, 256);
 	imageEncode = str;
+	pixelEncoding = Ueva::pixelEncoding(imageEncode);
+	AT_BOOL metadataEnable = AT_FALSE;
+	AT_BOOL metadataTimestamp = AT_FALSE;
+	clockFrequency = 0;
+	AT_GetBool(handle, L"MetadataEnable", &metadataEnable);
+	AT_GetBool(handle, L"MetadataTimestamp", &metadataTimestamp);
+	AT_GetInt(handle, L"TimestampClockFrequency", &clockFrequency);
+	hasTimestamp = metadataEnable && metadataTimestamp && clockFrequency > 0;
 
 	//// allocate buffer
 	buffers = new unsigned char*[queueLength];
@@ -645,16 +677,23 @@ void Zyla::start(const int &Ts)
 	{
 		buffers[i] = new unsigned char[bufferSize + 7];
 		alignedBuffers[i] = reinterpret_cast<unsigned char*>
-			((reinterpret_cast<unsigned	long>(buffers[i% queueLength]) + 7) & ~7);
+			((reinterpret_cast<size_t>(buffers[i]) + 7) & ~(size_t)7);
 	}
 	//// pass buffers to queue
 	for (int i = 0; i < queueLength; i++)
 	{
 		returnCode = AT_QueueBuffer(handle, alignedBuffers[i], bufferSize);
 	}
-	//// start acquisition
-	returnCode = AT_Command(handle, L"AcquisitionStart");
+	//// start acquisition, both clocks from zero
 	accumNumFrames = 0;
+	lastInfo = UevaFrameInfo();
+	lastTicks = 0;
+	dropCount = 0;
+	overflowCount = 0;
+	AT_Command(handle, L"TimestampClockReset");
+	clock.start();
+	returnCode = AT_Command(handle, L"AcquisitionStart");
+	std::cout << "zyla ring of " << queueLength << " frames" << std::endl;
 }
 
 void Zyla::stop()
@@ -671,37 +710,203 @@ void Zyla::stop()
 	delete[] alignedBuffers;
 }
 
-void Zyla::process(cv::Mat &image)
+cv::Size_<int> Zyla::frameSize() const
+{
+	return cv::Size_<int>((int)imageWidth, (int)imageHeight);
+}
+
+const UevaFrameInfo &Zyla::frameInfo() const
+{
+	return lastInfo;
+}
+
+qint64 Zyla::droppedFrames() const
+{
+	// without timestamps a gap can not be told from a slow frame
+	return hasTimestamp ? dropCount : -1;
+}
+
+int Zyla::overflows() const
+{
+	return overflowCount;
+}
+
+// metadata blocks sit at end of buffer, read backwards, each is data then 4 byte cid then 4 byte length of cid and data
+static bool metadataTicks(const unsigned char *buffer, const int size, AT_64 &ticks)
+{
+	int end = size;
+	while (end >= 8)
+	{
+		unsigned int length = 0;
+		unsigned int cid = 0;
+		std::memcpy(&length, buffer + end - 4, 4);
+		std::memcpy(&cid, buffer + end - 8, 4);
+		if (length < 4 || length + 4 > (unsigned int)end)
+		{
+			return false;
+		}
+		if (cid == 1 && length >= 12) // timestamp
+		{
+			std::memcpy(&ticks, buffer + end - 4 - length, 8);
+			return true;
+		}
+		if (cid == 0) // image itself, nothing before it
+		{
+			return false;
+		}
+		end -= 4 + length;
+	}
+	return false;
+}
+
+bool Zyla::waitBuffer(unsigned char *&pointer, const unsigned int timeout)
 {
-	//// grab buffer
-	unsigned char* pointer;
 	int size;
-	returnCode = AT_WaitBuffer(handle, &pointer, &size, 0); // timeout = 0, only get existing frames
-	//cerr << "zyla process wait buffer returns " << returnCode << endl;
-	if (returnCode == 0)
-	{
-		//// re-queue buffer
-		returnCode = AT_QueueBuffer(handle, alignedBuffers[accumNumFrames % queueLength], bufferSize);
-		//cerr << "re-queue returns " << returnCode << endl;
-		accumNumFrames++;
-		//// clean up buffer
-		image = cv::Mat(imageHeight, imageWidth, CV_16UC1);
-		returnCode = AT_ConvertBuffer(pointer, reinterpret_cast<unsigned char*>(image.data),
-			imageWidth, imageHeight, imageStride, imageEncode, L"Mono16");
-		//cerr << "convert returns " << returnCode << endl;
+	returnCode = AT_WaitBuffer(handle, &pointer, &size, timeout); // block until frame or timeout
+	if (returnCode == AT_ERR_HARDWARE_OVERFLOW)
+	{
+		// ring never delivers again after overflow, count once and start over
+		overflowCount++;
+		std::cout << "FAIL: zyla ring overflow, restart" << std::endl;
+		restartRing();
+		return false;
+	}
+	if (returnCode != AT_SUCCESS)
+	{
+		return false;
+	}
+
+	//// sequence from hardware timestamp gap, one frame when unknown
+	lastInfo.hostNs = clock.nsecsElapsed();
+	AT_64 ticks = 0;
+	AT_64 step = 1;
+	if (hasTimestamp && metadataTicks(pointer, size, ticks))
+	{
+		if (lastInfo.sequence >= 0 && frameRate > 0)
+		{
+			double frames = (double)(ticks - lastTicks) * frameRate / (double)clockFrequency;
+			step = std::max((AT_64)1, (AT_64)(frames + 0.5));
+		}
+		lastTicks = ticks;
+		lastInfo.timestamp = (double)ticks / (double)clockFrequency;
 	}
 	else
 	{
-		return;
+		lastInfo.timestamp = -1.0;
 	}
+	if (lastInfo.sequence >= 0)
+	{
+		dropCount += step - 1;
+		lastInfo.sequence += step;
+	}
+	else
+	{
+		lastInfo.sequence = 0;
+	}
+	return true;
 }
 
+void Zyla::requeueBuffer(unsigned char *pointer)
+{
+	// only after unpack so camera can not overwrite it, same buffer keeps ring size
+	returnCode = AT_QueueBuffer(handle, pointer, bufferSize);
+	accumNumFrames++;
+}
 
+void Zyla::restartRing()
+{
+	// same buffers back into queue, timestamp clock keeps running so gap shows up as dropped frames
+	returnCode = AT_Command(handle, L"AcquisitionStop");
+	returnCode = AT_Flush(handle);
+	for (int i = 0; i < queueLength; i++)
+	{
+		returnCode = AT_QueueBuffer(handle, alignedBuffers[i], bufferSize);
+	}
+	returnCode = AT_Command(handle, L"AcquisitionStart");
+}
 
+bool Zyla::setAoi(const AT_64 &left, const AT_64 &top, const AT_64 &width, const AT_64 &height)
+{
+	// move to corner first so any size is valid, then size, then offset
+	bool ok = true;
+	ok = AT_SetInt(handle, L"AOILeft", 1) == AT_SUCCESS && ok;
+	ok = AT_SetInt(handle, L"AOITop", 1) == AT_SUCCESS && ok;
+	ok = AT_SetInt(handle, L"AOIWidth", width) == AT_SUCCESS && ok;
+	ok = AT_SetInt(handle, L"AOIHeight", height) == AT_SUCCESS && ok;
+	ok = AT_SetInt(handle, L"AOILeft", left) == AT_SUCCESS && ok;
+	ok = AT_SetInt(handle, L"AOITop", top) == AT_SUCCESS && ok;
+	return ok;
+}
 
+bool Zyla::cropAoi(cv::Rect_<int> &roi)
+{
+	//// current aoi, left and top in sensor pixel, width and height in super pixel
+	AT_64 left = 1, top = 1, width = 0, height = 0, hBin = 1, vBin = 1;
+	AT_GetInt(handle, L"AOILeft", &left);
+	AT_GetInt(handle, L"AOITop", &top);
+	AT_GetInt(handle, L"AOIWidth", &width);
+	AT_GetInt(handle, L"AOIHeight", &height);
+	AT_GetInt(handle, L"AOIHBin", &hBin);
+	AT_GetInt(handle, L"AOIVBin", &vBin);
+	if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+		roi.x + roi.width > width || roi.y + roi.height > height)
+	{
+		std::cout << "FAIL: zyla aoi outside current image" << std::endl;
+		return false;
+	}
+
+	//// set new aoi
+	if (!setAoi(left + roi.x * hBin, top + roi.y * vBin, roi.width, roi.height))
+	{
+		std::cout << "FAIL: zyla can not set aoi, restore" << std::endl;
+		setAoi(left, top, width, height);
+		return false;
+	}
+
+	//// camera may round, report what it took
+	AT_64 newLeft = left, newTop = top, newWidth = roi.width, newHeight = roi.height;
+	AT_GetInt(handle, L"AOILeft", &newLeft);
+	AT_GetInt(handle, L"AOITop", &newTop);
+	AT_GetInt(handle, L"AOIWidth", &newWidth);
+	AT_GetInt(handle, L"AOIHeight", &newHeight);
+	cv::Rect_<int> taken((int)((newLeft - left) / hBin), (int)((newTop - top) / vBin),
+		(int)newWidth, (int)newHeight);
+	cv::Rect_<int> image(0, 0, (int)width, (int)height);
+	if ((taken & roi) != roi || (taken & image) != taken)
+	{
+		std::cout << "FAIL: zyla rounded aoi off roi, restore" << std::endl;
+		setAoi(left, top, width, height);
+		return false;
+	}
+	roi = taken;
+	std::cout << "zyla aoi " << newLeft << " " << newTop << " " <<
+		newWidth << " " << newHeight << std::endl;
+	return true;
+}
 
+bool Zyla::processGray(cv::Mat &gray, const unsigned int timeout, const bool parallel)
+{
+	//// grab buffer
+	unsigned char* pointer;
+	if (!waitBuffer(pointer, timeout))
+	{
+		return false;
+	}
+	//// unpack buffer
+	gray.create((int)imageHeight, (int)imageWidth, CV_8UC1);
+	if (pixelEncoding != Ueva::PIXEL_UNSUPPORTED)
+	{
+		Ueva::unpackTo8u(pointer, (size_t)imageStride, pixelEncoding, gray, parallel);
+	}
+	else
+	{
+		mono16.create((int)imageHeight, (int)imageWidth, CV_16UC1);
+		returnCode = AT_ConvertBuffer(pointer, reinterpret_cast<unsigned char*>(mono16.data),
+			imageWidth, imageHeight, imageStride, imageEncode, L"Mono16");
+		mono16.convertTo(gray, CV_8UC1, 0.00390625); // alpha = 1 / (2^16 / 2^8)
+	}
+	requeueBuffer(pointer);
+	return true;
+}
 
-
-
-
-
+#endif // UEVA_NO_ANDOR
@@ -21,15 +21,22 @@ along with RoboDrop. If not, see <http://www.gnu.org/licenses/>
 #ifndef ZYLA_H
 #define ZYLA_H
 
+#include "uevaframesource.h"
+#ifndef UEVA_NO_ANDOR
 
 #include "atcore.h"
 #include "atutility.h"
 #include "opencv2/core.hpp"
+#include "uevaunpack.h"
 #include <iostream>
 #include <QtGui>
+#include <QElapsedTimer>
 #include <map>
 #include <vector>
 #include <string>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 
 struct ZylaSettings
 {
@@ -52,7 +59,7 @@ struct ZylaSettings
 	std::map<AT_WC*, AT_WC*>::iterator enumMapIterator;
 };
 
-class Zyla
+class Zyla : public UevaFrameSource
 {
 public:
 	Zyla(int i);
@@ -61,9 +68,21 @@ public:
 
 	void get(ZylaSettings &s);
 	void set(ZylaSettings &s);
-	void start(const int &Ts);
+	QMap<QString, QString> defaultSettings();
+	QMap<QString, QString> getSettings();
+	void setSettings(const QMap<QString, QString> &s);
+	void start(const int &periodMs); // ring holds every frame made during periodMs or more
 	void stop();
-	void process(cv::Mat &image);
+	// wait at most timeout ms for next frame, false when none arrived
+	// native encoding goes straight to 8 bit, gray is created with its own allocator so caller can hand in a pool
+	bool processGray(cv::Mat &gray, const unsigned int timeout = 0, const bool parallel = false);
+	cv::Size_<int> frameSize() const; // valid after start
+	const UevaFrameInfo &frameInfo() const; // of frame last returned by processGray
+	qint64 droppedFrames() const; // camera made but never reached ring, from timestamp gaps, -1 without timestamps
+	int overflows() const; // ring ran out of buffers, ring restarted each time
+	// read out only roi of current image, binning kept, only while not acquiring
+	// roi becomes what camera accepted in same coordinates, false and old aoi restored when refused
+	bool cropAoi(cv::Rect_<int> &roi);
 
 
 protected:
@@ -80,15 +99,39 @@ private:
 	AT_64 imageWidth;
 	AT_64 imageHeight;
 	AT_WC *imageEncode;
+	int pixelEncoding; // Ueva::PixelEncoding of imageEncode
+	cv::Mat mono16; // only for encodings unpack does not know
 	int bufferSize;
 	double frameRate;
-	int samplePeriod;
+	int samplePeriod; // ms
 	int queueLength;
 
+	bool setAoi(const AT_64 &left, const AT_64 &top, const AT_64 &width, const AT_64 &height);
+	bool waitBuffer(unsigned char *&pointer, const unsigned int timeout);
+	void requeueBuffer(unsigned char *pointer);
+	void restartRing();
+
 	AT_64 accumNumFrames; // should last 1.8e17 seconds before overflow
 	unsigned char** buffers;
 	unsigned char** alignedBuffers;
 
+	ZylaSettings settings;
+
+	//// FRAME BOOKKEEPING
+	UevaFrameInfo lastInfo;
+	AT_64 clockFrequency; // camera timestamp ticks per second
+	AT_64 lastTicks;
+	bool hasTimestamp;
+	AT_64 dropCount;
+	int overflowCount;
+	QElapsedTimer clock;
+
+	enum ZylaConstants
+	{
+		MIN_QUEUE_LENGTH = 4,
+		MIN_RING_MS = 100, // ring covers at least this much even for short sample periods
+	};
+
 };
 
 
@@ -96,4 +139,5 @@ private:
 
 
 
+#endif // UEVA_NO_ANDOR
 #endif
\ No newline at end of file
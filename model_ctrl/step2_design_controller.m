@@ -503,6 +503,31 @@ for i = 1:size(channel_keep,1)
 end
 clear i
 
+%% RUNTIME DESIGN WEIGHTS
+% per plant state lqr weights, lets engine design controller of any channel
+% subset itself with same weights as above (exported by step3)
+num_state = size(PLANT.Ad,1);
+model.design.isfbR = ISFB_R;
+model.design.isfbQIntegral = ISFB_Q_INTEGRAL;
+model.design.obsrR = OBSR_R;
+model.design.isfbQ = ones(1,num_state);
+model.design.obsrQ = ones(1,num_state);
+model.design.isfbQ(1:length(allset)) = ISFB_Q_POSITION;
+model.design.obsrQ(1:length(allset)) = OBSR_Q_POS_ERROR;
+for j = 1:num_state
+    if ~isempty(strfind(cell2mat(PLANT.state_d(j)), 'Il_'))
+        model.design.isfbQ(j) = ISFB_Q_VELOCITY;
+        model.design.obsrQ(j) = OBSR_Q_VEL_ERROR;
+    end
+    if ~isempty(strfind(cell2mat(PLANT.state_d(j)), 'Uc_'))
+        model.design.isfbQ(j) = ISFB_Q_PRESSURE;
+    end
+    if ~isempty(strfind(cell2mat(PLANT.state_d(j)), 'UC_'))
+        model.design.obsrQ(j) = OBSR_Q_PRES_ERROR;
+    end
+end
+clear j num_state
+
 %% CLEAN UP
 clear MAX_DOF PLANT
 clear allset channel_delete channel_keep 
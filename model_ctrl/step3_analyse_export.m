@@ -23,6 +23,7 @@ along with uEva. If not, see <http://www.gnu.org/licenses/>
 % 2) plot closed loop frequency response to show decoupling
 % 3) lsim continuouse and discrete close loop system
 % 4) export controllers into yaml
+% 5) export full plant into yaml so engine can design missing controllers
 
 close all
 clearvars -except model ctrl_c ctrl_d
@@ -40,6 +41,8 @@ PLOT_RESOLUTION = 1000;
 SIM_STEP_DURATION = 10;
 SIM_STEP_HEIGHT = 100;
 
+EXPORT_BANK = true; % false leaves every controller to engine, for chips with many channels
+
 %% OPEN LOOP
 clc
 close all
@@ -130,14 +133,15 @@ filename = strrep(ctrl_d(1).name, 'model', 'ctrl');
 filename = [filename '.yaml'];
 file = fopen(filename, 'w');
 fprintf(file, '%%YAML:1.0\n');
-fprintf(file, 'numCtrl: %d\n', length(ctrl_d));
+num_export = length(ctrl_d) * EXPORT_BANK;
+fprintf(file, 'numCtrl: %d\n', num_export);
 fprintf(file, 'samplePeriod: %e\n', model.chip.Ts);
 fprintf(file, 'numPlantState: %d\n', length(model.chip.state_d));
 fprintf(file, 'numPlantInput: %d\n', length(model.chip.input));
 fprintf(file, 'numPlantOutput: %d\n', length(model.chip.output));
 
 %% PARSE EACH CONTROLLER
-for i = 1:length(ctrl_d)
+for i = 1:num_export
     fprintf(file, 'ctrl %d: \n', i-1); % ctrl 0 indexing
     
     CTRL = ctrl_d(i);
@@ -198,8 +202,44 @@ for i = 1:length(ctrl_d)
 end
 clear i
 
+%% PARSE PLANT
+fprintf(file, 'plant: \n');
+fprintf(file, '  isfbQIntegral: %.12e\n', model.design.isfbQIntegral);
+fprintf(file, '  isfbR: %.12e\n', model.design.isfbR);
+fprintf(file, '  obsrR: %.12e\n', model.design.obsrR);
+plant.A = PLANT.Ad;
+plant.B = PLANT.Bd;
+plant.C = PLANT.Cd;
+plant.D = PLANT.Dd;
+plant.isfbQ = model.design.isfbQ;
+plant.obsrQ = model.design.obsrQ;
+matrixNames = {'A','B','C','D','isfbQ','obsrQ'};
+for j = 1:length(matrixNames)
+    matrixName = matrixNames{j};
+    matrix = plant.(matrixName)'; % col first linear indexing
+    [cols, rows] = size(matrix);
+    fprintf(file, '  %s: !!opencv-matrix\n', matrixName);
+    fprintf(file, '    rows: %d\n', rows);
+    fprintf(file, '    cols: %d\n', cols);
+    fprintf(file, '    dt: d\n'); % data type = double
+    fprintf(file, '    data: [ ');
+    for k = 1:rows*cols
+        fprintf(file, '%.12e', matrix(k)); % 12 decimal places
+        if (k == rows*cols)
+            break;
+        end
+        fprintf(file, ', ');
+        if mod(k,cols) == 0
+            fprintf(file, '\n            ');
+        end
+    end
+    clear k cols rows matrix
+    fprintf(file,' ]\n');
+end
+clear j plant
+
 fclose(file);
-clear CTRL_INDEX PLANT
+clear CTRL_INDEX PLANT EXPORT_BANK num_export
 clear PLOT* SIM*
 clear filename file CTRL
 clear matrixName matrixNames ans